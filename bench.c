@@ -0,0 +1,274 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NOB_IMPL
+#include "nob.h"
+#define CARVE_IMPLEMENTATION
+#include "carve.h"
+
+typedef struct {
+  const char *name;
+  int width;
+  int height;
+} Bench_Case;
+
+static Bench_Case bench_cases[] = {
+    {"1mp", 1024, 1024},   {"12mp", 4000, 3000},  {"48mp", 8000, 6000},
+    {"wide", 16384, 256}, {"tall", 256, 16384},
+};
+
+typedef enum {
+  BENCH_LUMINANCE,
+  BENCH_SOBEL,
+  BENCH_DP,
+  BENCH_BACKTRACK,
+  BENCH_COMPACTION,
+  BENCH_UPDATE,
+  COUNT_BENCH_PHASES,
+} Bench_Phase;
+
+static const char *bench_phase_names[COUNT_BENCH_PHASES] = {
+    [BENCH_LUMINANCE] = "luminance", [BENCH_SOBEL] = "sobel",
+    [BENCH_DP] = "dp",               [BENCH_BACKTRACK] = "backtrack",
+    [BENCH_COMPACTION] = "compaction", [BENCH_UPDATE] = "update",
+};
+
+typedef struct {
+  char key[64];
+  uint64_t median;
+  uint64_t min;
+} Bench_Result;
+
+typedef struct {
+  Bench_Result *items;
+  size_t count;
+  size_t capacity;
+} Bench_Results;
+
+typedef struct {
+  Img img;
+  Mat lum;
+  Mat edges;
+  Mat dp;
+  int *seam;
+  float *zeros;
+} Bench_State;
+
+// Smooth gradients with a bit of noise, so the dp has actual seams to find
+// and every run sees the same picture.
+static void bench_fill(Img img) {
+  uint32_t state = 0x9e3779b9;
+  for (int y = 0; y < img.height; y++) {
+    for (int x = 0; x < img.width; x++) {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      float fx = (float)x / img.width, fy = (float)y / img.height;
+      Pixel p = {
+          .red = (uint32_t)(127 + 100 * sinf(fx * 31 + fy * 7)) + state % 16,
+          .green = (uint32_t)(127 + 100 * cosf(fy * 23 - fx * 5)) + state % 8,
+          .blue = (uint32_t)(127 + 100 * sinf((fx + fy) * 13)),
+          .alpha = 255,
+      };
+      MAT_AT(img, y, x) = p;
+    }
+  }
+}
+
+static void bench_run_phase(const Kernels *k, Bench_State *s,
+                            Bench_Phase phase) {
+  switch (phase) {
+  case BENCH_LUMINANCE:
+    k->rgb_to_lum(img_raster(s->img), LUM_REC601, s->lum);
+    break;
+  case BENCH_SOBEL:
+    k->energies[ENERGY_SOBEL].filter(img_raster(s->img), s->lum, (Mask){0},
+                                     s->edges, s->zeros);
+    break;
+  case BENCH_DP:
+    k->build_dp(s->edges, s->dp);
+    break;
+  case BENCH_BACKTRACK:
+    find_seam(s->dp, s->seam);
+    break;
+  case BENCH_COMPACTION:
+    // the width is left alone, so every run moves the same amount of data
+    k->remove_seam(s->seam, img_raster(s->img), s->lum, s->edges, (Mask){0});
+    break;
+  case BENCH_UPDATE:
+    k->energies[ENERGY_SOBEL].update(s->seam, img_raster(s->img), s->lum,
+                                     s->edges, (Mask){0}, NULL, NULL,
+                                     s->zeros);
+    break;
+  default:
+    NOB_ASSERT(0 && "unreachable");
+  }
+}
+
+static bool bench_load_baseline(const char *path, Bench_Results *baseline) {
+  NOB_String_Builder sb = {0};
+  if (!nob_read_entire_file(path, &sb))
+    return false;
+  nob_sb_append_null(&sb);
+  // one result per line, as written by bench_save
+  for (char *line = strtok(sb.items, "\n"); line != NULL;
+       line = strtok(NULL, "\n")) {
+    Bench_Result r = {0};
+    unsigned long long median, min;
+    if (sscanf(line, " \"%63[^\"]\": {\"median_ns\": %llu, \"min_ns\": %llu}",
+               r.key, &median, &min) == 3) {
+      r.median = median;
+      r.min = min;
+      nob_da_append(baseline, r);
+    }
+  }
+  nob_sb_free(sb);
+  return true;
+}
+
+static bool bench_save(const char *path, Bench_Results results) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    nob_log(NOB_ERROR, "could not open %s: %s", path, str_err_no);
+    return false;
+  }
+  fprintf(f, "{\n");
+  for (size_t i = 0; i < results.count; i++) {
+    fprintf(f, "  \"%s\": {\"median_ns\": %llu, \"min_ns\": %llu}%s\n",
+            results.items[i].key, (unsigned long long)results.items[i].median,
+            (unsigned long long)results.items[i].min,
+            i + 1 < results.count ? "," : "");
+  }
+  fprintf(f, "}\n");
+  fclose(f);
+  return true;
+}
+
+static const Bench_Result *bench_find(Bench_Results results, const char *key) {
+  for (size_t i = 0; i < results.count; i++) {
+    if (strcmp(results.items[i].key, key) == 0)
+      return &results.items[i];
+  }
+  return NULL;
+}
+
+static void usage(const char *program) {
+  nob_log(NOB_ERROR,
+          "Usage: %s [-n <iterations>] [-W <warmup>] [-c <case>] "
+          "[-k <kernels>] [-b <baseline.json>] [-o <results.json>]\n",
+          program);
+  nob_log(NOB_ERROR, "cases: 1mp 12mp 48mp wide tall (default: all)");
+}
+
+int main(int argc, char **argv) {
+  const char *program = nob_shift_args(&argc, &argv);
+
+  int iterations = 7;
+  int warmup = 2;
+  const char *only_case = NULL;
+  const char *baseline_path = NULL;
+  const char *output_path = NULL;
+  const Kernels *k = kernels_select(NULL);
+  while (argc > 0) {
+    const char *flag = nob_shift_args(&argc, &argv);
+    if (argc <= 0) {
+      usage(program);
+      return EXIT_FAILURE;
+    }
+    const char *value = nob_shift_args(&argc, &argv);
+    if (strcmp(flag, "-n") == 0) {
+      iterations = atoi(value);
+    } else if (strcmp(flag, "-W") == 0) {
+      warmup = atoi(value);
+    } else if (strcmp(flag, "-c") == 0) {
+      only_case = value;
+    } else if (strcmp(flag, "-k") == 0) {
+      k = kernels_select(value);
+      if (k == NULL)
+        return EXIT_FAILURE;
+    } else if (strcmp(flag, "-b") == 0) {
+      baseline_path = value;
+    } else if (strcmp(flag, "-o") == 0) {
+      output_path = value;
+    } else {
+      usage(program);
+      nob_log(NOB_ERROR, "unknown flag: %s", flag);
+      return EXIT_FAILURE;
+    }
+  }
+  if (iterations < 1)
+    iterations = 1;
+
+  Bench_Results baseline = {0};
+  if (baseline_path != NULL && !bench_load_baseline(baseline_path, &baseline))
+    return EXIT_FAILURE;
+
+  Bench_Results results = {0};
+  uint64_t *samples = NOB_REALLOC(NULL, iterations * sizeof(*samples));
+  NOB_ASSERT(samples != NULL && "buy more ram lol");
+
+  nob_log(NOB_INFO, "kernels: %s", k->name);
+  nob_log(NOB_INFO, "%-20s %12s %12s %10s %10s", "case/phase", "median ms",
+          "min ms", "Mpx/s", "vs base");
+  for (size_t c = 0; c < NOB_ARRAY_LEN(bench_cases); c++) {
+    Bench_Case bc = bench_cases[c];
+    if (only_case != NULL && strcmp(only_case, bc.name) != 0)
+      continue;
+
+    Bench_State s = {0};
+    mat_alloc(Img, img, bc.height, bc.width);
+    mat_alloc(Mat, lum, bc.height, bc.width);
+    mat_alloc(Mat, edges, bc.height, bc.width);
+    mat_alloc(Mat, dp, bc.height, bc.width);
+    s.img = img;
+    s.lum = lum;
+    s.edges = edges;
+    s.dp = dp;
+    s.seam = NOB_REALLOC(NULL, bc.height * sizeof(*s.seam));
+    s.zeros = calloc(bc.width, sizeof(*s.zeros));
+    NOB_ASSERT(s.seam != NULL && s.zeros != NULL && "buy more ram lol");
+    bench_fill(s.img);
+
+    for (int phase = 0; phase < COUNT_BENCH_PHASES; phase++) {
+      for (int i = 0; i < warmup; i++)
+        bench_run_phase(k, &s, phase);
+      for (int i = 0; i < iterations; i++) {
+        uint64_t begin = carve_now_ns();
+        bench_run_phase(k, &s, phase);
+        samples[i] = carve_now_ns() - begin;
+      }
+      qsort(samples, iterations, sizeof(*samples), u64_compare);
+
+      Bench_Result r = {
+          .median = samples[iterations / 2],
+          .min = samples[0],
+      };
+      snprintf(r.key, sizeof(r.key), "%s/%s", bc.name,
+               bench_phase_names[phase]);
+      nob_da_append(&results, r);
+
+      double mpx = (double)bc.width * bc.height / 1e6;
+      const Bench_Result *base = bench_find(baseline, r.key);
+      char delta[32] = "-";
+      if (base != NULL)
+        snprintf(delta, sizeof(delta), "%+.1f%%",
+                 100.0 * ((double)r.median - base->median) / base->median);
+      nob_log(NOB_INFO, "%-20s %12.3f %12.3f %10.1f %10s", r.key,
+              r.median / 1e6, r.min / 1e6, mpx / (r.median / 1e9), delta);
+    }
+
+    NOB_FREE(s.img.items);
+    NOB_FREE(s.lum.items);
+    NOB_FREE(s.edges.items);
+    NOB_FREE(s.dp.items);
+    NOB_FREE(s.seam);
+    NOB_FREE(s.zeros);
+  }
+
+  if (output_path != NULL && !bench_save(output_path, results))
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
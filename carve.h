@@ -0,0 +1,2994 @@
+/**
+ * @file carve.h
+ * @brief Seam carving core shared by the command line tool and the daemon.
+ *
+ * Define CARVE_IMPLEMENTATION in exactly one translation unit before
+ * including this file, the same way nob.h and the stb headers work.
+ */
+
+#ifndef CARVE_H_
+#define CARVE_H_
+
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#include "nob.h"
+
+#define CARVE_DEFAULT_SEAMS 500
+// how far a seam may move away from the scaled up proxy seam on either side
+#define CARVE_PROXY_BAND 3
+#define CARVE_BAND_SLACK 1.25f
+// band around the previous frame's seams when Carve_Opts.band is not set
+#define CARVE_PRIOR_BAND 8
+// columns on either side of the guide seam for carve_volume
+#define CARVE_VOLUME_BAND 8
+// energy of protected pixels, and minus the energy of pixels to remove; far
+// above what a whole column of sobel energy adds up to
+#define CARVE_MASK_ENERGY 1e6f
+// table cells times pixels the optimal order may go through, an eighth of it
+// bounds the floats kept for two rows of the table
+#define CARVE_ORDER_BUDGET (1 << 28)
+// bytes the float dp plane may take before DP_PLANE turns into DP_CHECKPOINT
+#define CARVE_DP_BUDGET ((size_t)1 << 30)
+
+typedef struct {
+  uint32_t red : 8;
+  uint32_t green : 8;
+  uint32_t blue : 8;
+  uint32_t alpha : 8;
+} Pixel;
+
+typedef struct {
+  int height;
+  int width;
+  int stride;
+  Pixel *items;
+} Img;
+
+typedef struct {
+  int height;
+  int width;
+  int stride;
+  float *items;
+} Mat;
+
+// Storage of every channel of a Raster.
+typedef enum {
+  DEPTH_8 = 0,
+  DEPTH_16,
+  DEPTH_FLOAT,
+  COUNT_DEPTHS,
+} Pixel_Depth;
+
+// Interleaved pixels of 1 (gray), 2 (gray and alpha), 3 (RGB) or 4 (RGBA)
+// channels of any depth, an Img is a Raster of 4 channels of DEPTH_8. The
+// stride is in pixels, like everywhere else.
+typedef struct {
+  int height;
+  int width;
+  int stride;
+  Pixel_Depth depth;
+  int channels;
+  void *items;
+} Raster;
+
+// Per pixel marks of the user's mask, compacted along with the image.
+typedef struct {
+  int height;
+  int width;
+  int stride;
+  uint8_t *items;
+} Mask;
+
+typedef enum {
+  MASK_NONE = 0,
+  // never carved through as long as there is another way
+  MASK_PROTECT,
+  // carved through before anything else
+  MASK_REMOVE,
+} Mask_Mark;
+
+typedef enum {
+  // sobel magnitude of the luminance
+  ENERGY_SOBEL = 0,
+  // sum of the sobel magnitudes of red, green and blue, taken on the pixels
+  // themselves, so edges between colors of the same luminance count too
+  ENERGY_COLOR,
+  // the largest of those three magnitudes
+  ENERGY_COLOR_MAX,
+  // scharr magnitude of the luminance, closer to rotation invariant than
+  // sobel
+  ENERGY_SCHARR,
+  // |dI/dx| + |dI/dy| of the luminance from central differences, the e1 of
+  // the paper
+  ENERGY_L1,
+  // a precomputed map given in Carve_Opts.energy_map, like a saliency map
+  ENERGY_EXTERNAL,
+  COUNT_ENERGIES,
+} Energy_Kind;
+
+// How pixels become the luminance the energy is taken on. The result is in
+// [0, 1] for integer depths; floats are taken as linear light as they are,
+// so they can go above 1.
+typedef enum {
+  // Rec. 601 luma of the encoded values
+  LUM_REC601 = 0,
+  // Rec. 709 luma of the encoded values
+  LUM_REC709,
+  // relative luminance, Rec. 709 weights on sRGB decoded values
+  LUM_LINEAR,
+  // CIELAB lightness L* of that luminance, divided by 100
+  LUM_LAB,
+  COUNT_LUM_MODELS,
+} Lum_Model;
+
+// Order of vertical and horizontal seams when both dimensions shrink.
+typedef enum {
+  // all vertical seams, then all horizontal ones
+  ORDER_WIDTH_FIRST = 0,
+  // whichever of the two cheapest seams costs less at every step
+  ORDER_GREEDY,
+  // the order of least total cost through the transport map of the paper,
+  // solved on pooled energy small enough for CARVE_ORDER_BUDGET
+  ORDER_OPTIMAL,
+  COUNT_ORDERS,
+} Carve_Order;
+
+// How the cumulative energy of vertical seams is kept.
+typedef enum {
+  // a full float plane, caught up after every seam instead of rebuilt
+  DP_PLANE = 0,
+  // two rolling float rows and a plane of 2 bit steps to backtrack along,
+  // a sixteenth of the memory of the float plane
+  DP_ROLLING,
+  // only every ~sqrt(height)th row of the dp, the rows in between are
+  // computed again segment by segment while backtracking, for twice the dp
+  // work in O(width * sqrt(height)) memory
+  DP_CHECKPOINT,
+  COUNT_DP_MODES,
+} Dp_Mode;
+
+typedef enum {
+  PHASE_DECODE,
+  PHASE_LUMINANCE,
+  PHASE_SOBEL,
+  PHASE_DP,
+  PHASE_BACKTRACK,
+  PHASE_COMPACTION,
+  PHASE_UPDATE,
+  PHASE_SEAM,
+  PHASE_ENCODE,
+  COUNT_PHASES,
+} Phase;
+
+typedef struct {
+  uint64_t *items;
+  size_t count;
+  size_t capacity;
+} Phase_Samples;
+
+// Chrome trace event file shared by every thread that carves. Events are
+// written as a JSON array that perfetto and chrome://tracing can load.
+typedef struct {
+  FILE *file;
+  uint64_t origin;
+  pthread_mutex_t lock;
+} Carve_Trace;
+
+typedef enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  COUNT_PERF_COUNTERS,
+} Perf_Counter;
+
+// Hardware counters of the calling thread, read as one perf_event_open group
+// at the start and end of every phase.
+typedef struct {
+  int fds[COUNT_PERF_COUNTERS];
+  uint64_t begin[COUNT_PHASES][COUNT_PERF_COUNTERS];
+  uint64_t totals[COUNT_PHASES][COUNT_PERF_COUNTERS];
+} Carve_Perf;
+
+// Wall clock samples in nanoseconds, one per run of a phase. The per seam
+// phases get one sample per seam so their distribution can be reported.
+typedef struct {
+  Phase_Samples samples[COUNT_PHASES];
+  uint64_t pixels[COUNT_PHASES];
+  // counts cycles, instructions and misses of every phase when not NULL
+  Carve_Perf *perf;
+  // every phase also becomes a trace span when not NULL
+  Carve_Trace *trace;
+  NOB_String_Builder events;
+  long tid;
+} Carve_Stats;
+
+// The loops of one energy, see Energy_Kind. The energies of the luminance
+// read lum, the color ones img, so each only ever pays for its own source:
+// a carve with a color energy keeps no lum at all.
+typedef struct {
+  // the mask is applied to the energy in the same pass, its items may be
+  // NULL. zeros is a row of as many zeros as the image is wide, for the
+  // border above and below.
+  void (*filter)(Raster img, Mat lum, Mask mask, Mat grad,
+                 const float *zeros);
+  // refreshes the energy around a removed seam, img, lum and edges must
+  // already have their reduced width; the columns it rewrote in every row go
+  // to lo and hi, which may be NULL, see update_dp
+  void (*update)(const int *seam, Raster img, Mat lum, Mat edges, Mask mask,
+                 int *lo, int *hi, const float *zeros);
+} Energy_Kernels;
+
+// One implementation of the hot loops. carve.h has the scalar reference,
+// kernels.c is compiled into one table per instruction set.
+typedef struct {
+  const char *name;
+  bool (*supported)(void);
+  // luminance of every pixel under the model, see Lum_Model
+  void (*rgb_to_lum)(Raster img, Lum_Model model, Mat lum);
+  // full pass and refresh of every energy, indexed by Energy_Kind
+  Energy_Kernels energies[COUNT_ENERGIES];
+  // dp may be the same plane as mat
+  void (*build_dp)(Mat mat, Mat dp);
+  // build_dp of rows further down, prev is the dp of the row right above
+  // the first row of mat
+  void (*continue_dp)(const float *prev, Mat mat, Mat dp);
+  // the dp of DP_ROLLING: fills dirs with the step every pixel takes to the
+  // row above, see build_dirs, and returns the cost of the cheapest seam and
+  // its column in the last row. scratch has room for three rows of mat.
+  float (*build_dirs)(Mat mat, uint8_t *dirs, int *last, float *scratch);
+  // returns how many of the removed pixels were marked MASK_REMOVE
+  int (*remove_seam)(const int *seam, Raster img, Mat lum, Mat edges,
+                     Mask mask);
+  // catches a dp plane up with the seam removed since it was built, given
+  // the columns the energy update rewrote. scratch has room for a row of dp.
+  void (*update_dp)(Mat edges, Mat dp, const int *seam, const int *lo,
+                    const int *hi, float *scratch);
+} Kernels;
+
+// Every seam removed by a carve, in the order they were removed. A seam is
+// stored as its column in the first row as a uint32 followed by the step to
+// every next row (-1, 0 or +1) in 2 bits, so the columns are relative to the
+// image with all earlier seams already gone. seam_stream_replay applies them
+// to any plane of the original size without computing any energy.
+typedef struct {
+  int width;
+  int height;
+  int seams;
+  uint8_t *items;
+  size_t count;
+  size_t capacity;
+} Seam_Stream;
+
+typedef struct {
+  // width of the result, <= 0 removes CARVE_DEFAULT_SEAMS seams
+  int target_width;
+  // height of the result, <= 0 keeps the height
+  int target_height;
+  Carve_Order order;
+  Energy_Kind energy;
+  Lum_Model lum_model;
+  // the energy of ENERGY_EXTERNAL, of the same size as the image. It takes
+  // the place of the luminance and is compacted along with it, so the energy
+  // around every seam is refreshed from the map itself.
+  Mat energy_map;
+  // only applies to full searches of vertical seams, bands, proxies,
+  // priors and horizontal seams always use DP_PLANE
+  Dp_Mode dp;
+  // bytes the float dp plane of DP_PLANE may take, CARVE_DP_BUDGET when 0
+  size_t dp_budget;
+  // NULL picks the fastest kernels the cpu supports
+  const Kernels *kernels;
+  // carved along with img when its items are not NULL
+  Mask mask;
+  // collects phase timings when not NULL
+  Carve_Stats *stats;
+  // records every removed seam when not NULL
+  Seam_Stream *seams;
+  // > 1 finds the seams on a copy downscaled by this power of two first and
+  // only refines them around the scaled up path at every level in between
+  int proxy;
+  // > 0 searches every seam within this many columns of the previous one,
+  // with a full dp whenever that costs more than CARVE_BAND_SLACK times the
+  // seam of the last full dp
+  int band;
+  // removes vertical seams until no MASK_REMOVE pixel is left instead of
+  // carving to the target size, needs a mask
+  bool object_removal;
+  // after the object removal, inserts as many seams as were removed to get
+  // back to the original width
+  bool restore_width;
+  // seams of the previous frame of a sequence, of the same size; every seam
+  // is searched in a band around the one removed at the same step there
+  const Seam_Stream *prior;
+} Carve_Opts;
+
+// Grow-only storage for the float planes of a carve. Keeping one around
+// between images means the pages are already faulted in for the next one.
+typedef struct {
+  float *items;
+  size_t capacity;
+} Carve_Arena;
+
+#define mat_alloc(mat_kind, m_name, m_height, m_width)                         \
+  NOB_ASSERT((m_width) > 0 && (m_height) > 0 &&                                \
+             "enter valid matrix dimensions");                                 \
+  mat_kind m_name = {0};                                                       \
+  do {                                                                         \
+    m_name.height = m_height;                                                  \
+    m_name.stride = m_name.width = m_width;                                    \
+    m_name.items =                                                             \
+        NOB_REALLOC(NULL, sizeof(*m_name.items) * (m_width) * (m_height));     \
+    NOB_ASSERT(m_name.items != NULL && "buy more ram lol");                    \
+  } while (0)
+
+// the row offset is 64 bit, planes of more than 2^31 elements are fine as
+// long as a single row is not
+#define MAT_AT(m, y, x) (m).items[(x) + (ptrdiff_t)(y) * (m).stride]
+#define MAT_WITHIN(m, y, x)                                                    \
+  (0 <= (y) && 0 <= (x) && (y) < (m).height && (x) < (m).width)
+#define MAT_SAME_DIM(m1, m2)                                                   \
+  ((m1).width == (m2).width && (m1).height == (m2).height)
+
+static inline size_t raster_pixel_size(Raster r) {
+  static const size_t channel_size[COUNT_DEPTHS] = {
+      [DEPTH_8] = 1,
+      [DEPTH_16] = 2,
+      [DEPTH_FLOAT] = 4,
+  };
+  return r.channels * channel_size[r.depth];
+}
+
+static inline uint8_t *raster_row(Raster r, int y) {
+  return (uint8_t *)r.items + (size_t)y * r.stride * raster_pixel_size(r);
+}
+
+// Channels the color energies take the gradient on, gray images only have
+// the one.
+static inline int color_channels(Raster img) {
+  return img.channels < 3 ? 1 : 3;
+}
+
+static inline Raster img_raster(Img img) {
+  return (Raster){img.height, img.width, img.stride, DEPTH_8, 4, img.items};
+}
+
+// Weights of red, green and blue in the luminance of the model.
+static inline void lum_weights(Lum_Model model, double weights[3]) {
+  bool rec601 = model == LUM_REC601;
+  weights[0] = rec601 ? 0.299 : 0.2126;
+  weights[1] = rec601 ? 0.587 : 0.7152;
+  weights[2] = rec601 ? 0.114 : 0.0722;
+}
+
+// Cube root of t > 0: a guess from the exponent bits and two Halley steps,
+// within a few ulp. Only basic float operations, so every kernel variant
+// gets the same bits and the loops around it vectorize.
+static inline float carve_cbrtf(float t) {
+  uint32_t bits;
+  memcpy(&bits, &t, sizeof(bits));
+  bits = bits / 3 + 0x2a514067u;
+  float y;
+  memcpy(&y, &bits, sizeof(y));
+  // unrolled, a loop here would keep the callers from vectorizing
+  float y3 = y * y * y;
+  y = y * (y3 + 2.0f * t) / (2.0f * y3 + t);
+  y3 = y * y * y;
+  y = y * (y3 + 2.0f * t) / (2.0f * y3 + t);
+  return y;
+}
+
+// CIELAB L* / 100 of a relative luminance, with the white point at 1. Both
+// pieces are computed and one is picked by its bits: a float select would
+// be a branch, the compiler may not speculate float math that can trap.
+static inline float lab_lightness(float y) {
+  float cube = carve_cbrtf(y);
+  float line = y * (841.0f / 108.0f) + 4.0f / 29.0f;
+  uint32_t c, l, pick = -(uint32_t)(y > 216.0f / 24389.0f);
+  memcpy(&c, &cube, sizeof(c));
+  memcpy(&l, &line, sizeof(l));
+  c = (c & pick) | (l & ~pick);
+  float f;
+  memcpy(&f, &c, sizeof(f));
+  return (116.0f * f - 16.0f) / 100.0f;
+}
+
+static inline float mask_energy(float energy, uint8_t mark) {
+  return mark == MASK_PROTECT  ? CARVE_MASK_ENERGY
+         : mark == MASK_REMOVE ? -CARVE_MASK_ENERGY
+                               : energy;
+}
+
+const char *energy_name(Energy_Kind energy);
+bool energy_by_name(const char *name, Energy_Kind *energy);
+const char *order_name(Carve_Order order);
+bool order_by_name(const char *name, Carve_Order *order);
+const char *dp_mode_name(Dp_Mode mode);
+bool dp_mode_by_name(const char *name, Dp_Mode *mode);
+const char *lum_model_name(Lum_Model model);
+bool lum_model_by_name(const char *name, Lum_Model *model);
+// sRGB decoded values of every 8 or 16 bit sample, built on first use.
+const float *srgb_decode_table(Pixel_Depth depth);
+
+#if defined(__x86_64__) && !defined(CARVE_NO_SIMD)
+#define CARVE_SIMD
+extern const Kernels kernels_sse2;
+extern const Kernels kernels_avx2;
+extern const Kernels kernels_avx512;
+#endif
+
+extern const Kernels kernels_scalar;
+extern const Kernels *const carve_kernels[];
+extern const size_t carve_kernels_count;
+// NULL selects the fastest supported table, otherwise the one with that name
+// if the cpu can run it.
+const Kernels *kernels_select(const char *name);
+
+const char *phase_name(Phase phase);
+uint64_t phase_begin(Carve_Stats *stats, Phase phase);
+// pixels is the amount of work the phase did, used to report per pixel costs
+void phase_end(Carve_Stats *stats, Phase phase, uint64_t begin,
+               uint64_t pixels);
+void carve_stats_report(Carve_Stats *stats);
+void carve_stats_free(Carve_Stats *stats);
+void carve_stats_flush(Carve_Stats *stats);
+bool carve_perf_open(Carve_Perf *perf);
+void carve_perf_close(Carve_Perf *perf);
+void carve_perf_report(Carve_Stats *stats);
+bool carve_trace_open(Carve_Trace *trace, const char *path);
+void carve_trace_close(Carve_Trace *trace);
+
+void seam_stream_begin(Seam_Stream *stream, int width, int height);
+void seam_stream_push(Seam_Stream *stream, const int *seam);
+bool seam_stream_save(const Seam_Stream *stream, const char *path);
+bool seam_stream_load(Seam_Stream *stream, const char *path);
+void seam_stream_free(Seam_Stream *stream);
+// Removes the recorded seams from a plane of stream->width by stream->height
+// elements of the given size in one pass over the rows, and returns the new
+// width.
+int seam_stream_replay(const Seam_Stream *stream, void *items, int stride,
+                       size_t size);
+
+int carve_seams_for(Img img, Carve_Opts opts);
+int carve_rows_for(Img img, Carve_Opts opts);
+void carve_arena_free(Carve_Arena *arena);
+// Carves img in place and returns it with the reduced width and height; the
+// stride and the pixel buffer stay the same.
+Img carve(Img img, Carve_Opts opts, Carve_Arena *arena);
+// carve for pixels of any depth and channel count. The seams only depend on
+// the luminance, so a 16 bit or float image carves like its 8 bit version
+// would, but keeps its full depth, and a gray one like its RGB expansion.
+Raster carve_raster(Raster img, Carve_Opts opts, Carve_Arena *arena);
+// Carves every frame of a clip, all of the same size, by seam surfaces found
+// as minimum cuts through the whole volume, so the seams agree across frames.
+// Only target_width, energy, lum_model, kernels and band (the columns
+// searched on either side of a guide seam, CARVE_VOLUME_BAND when not set)
+// are used. The frames are carved in place and come back with their reduced
+// width.
+void carve_volume(Img *frames, int count, Carve_Opts opts);
+
+#endif // CARVE_H_
+
+#ifdef CARVE_IMPLEMENTATION
+
+static const char *energy_names[COUNT_ENERGIES] = {
+    [ENERGY_SOBEL] = "sobel",
+    [ENERGY_COLOR] = "color",
+    [ENERGY_COLOR_MAX] = "color-max",
+    [ENERGY_SCHARR] = "scharr",
+    [ENERGY_L1] = "l1",
+    [ENERGY_EXTERNAL] = "external",
+};
+
+const char *energy_name(Energy_Kind energy) {
+  NOB_ASSERT(0 <= energy && energy < COUNT_ENERGIES);
+  return energy_names[energy];
+}
+
+bool energy_by_name(const char *name, Energy_Kind *energy) {
+  for (int i = 0; i < COUNT_ENERGIES; i++) {
+    if (strcmp(name, energy_names[i]) == 0) {
+      *energy = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static const char *order_names[COUNT_ORDERS] = {
+    [ORDER_WIDTH_FIRST] = "width-first",
+    [ORDER_GREEDY] = "greedy",
+    [ORDER_OPTIMAL] = "optimal",
+};
+
+const char *order_name(Carve_Order order) {
+  NOB_ASSERT(0 <= order && order < COUNT_ORDERS);
+  return order_names[order];
+}
+
+bool order_by_name(const char *name, Carve_Order *order) {
+  for (int i = 0; i < COUNT_ORDERS; i++) {
+    if (strcmp(name, order_names[i]) == 0) {
+      *order = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static const char *dp_mode_names[COUNT_DP_MODES] = {
+    [DP_PLANE] = "plane",
+    [DP_ROLLING] = "rolling",
+    [DP_CHECKPOINT] = "checkpoint",
+};
+
+const char *dp_mode_name(Dp_Mode mode) {
+  NOB_ASSERT(0 <= mode && mode < COUNT_DP_MODES);
+  return dp_mode_names[mode];
+}
+
+bool dp_mode_by_name(const char *name, Dp_Mode *mode) {
+  for (int i = 0; i < COUNT_DP_MODES; i++) {
+    if (strcmp(name, dp_mode_names[i]) == 0) {
+      *mode = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static const char *lum_model_names[COUNT_LUM_MODELS] = {
+    [LUM_REC601] = "rec601",
+    [LUM_REC709] = "rec709",
+    [LUM_LINEAR] = "linear",
+    [LUM_LAB] = "lab",
+};
+
+const char *lum_model_name(Lum_Model model) {
+  NOB_ASSERT(0 <= model && model < COUNT_LUM_MODELS);
+  return lum_model_names[model];
+}
+
+bool lum_model_by_name(const char *name, Lum_Model *model) {
+  for (int i = 0; i < COUNT_LUM_MODELS; i++) {
+    if (strcmp(name, lum_model_names[i]) == 0) {
+      *model = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static float srgb_decode_8[1 << 8];
+static float srgb_decode_16[1 << 16];
+static pthread_once_t srgb_decode_once_8 = PTHREAD_ONCE_INIT;
+static pthread_once_t srgb_decode_once_16 = PTHREAD_ONCE_INIT;
+
+static double srgb_decode(double v) {
+  return v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+}
+
+static void srgb_decode_init_8(void) {
+  for (int i = 0; i < 1 << 8; i++)
+    srgb_decode_8[i] = srgb_decode(i / 255.0);
+}
+
+// 65536 pow calls, only paid by 16 bit images
+static void srgb_decode_init_16(void) {
+  for (int i = 0; i < 1 << 16; i++)
+    srgb_decode_16[i] = srgb_decode(i / 65535.0);
+}
+
+const float *srgb_decode_table(Pixel_Depth depth) {
+  NOB_ASSERT(depth == DEPTH_8 || depth == DEPTH_16);
+  if (depth == DEPTH_8) {
+    pthread_once(&srgb_decode_once_8, srgb_decode_init_8);
+    return srgb_decode_8;
+  }
+  pthread_once(&srgb_decode_once_16, srgb_decode_init_16);
+  return srgb_decode_16;
+}
+
+static const char *phase_names[COUNT_PHASES] = {
+    [PHASE_DECODE] = "decode",
+    [PHASE_LUMINANCE] = "luminance",
+    [PHASE_SOBEL] = "initial sobel",
+    [PHASE_DP] = "cumulative dp",
+    [PHASE_BACKTRACK] = "seam backtrack",
+    [PHASE_COMPACTION] = "compaction",
+    [PHASE_UPDATE] = "energy update",
+    [PHASE_SEAM] = "whole seam",
+    [PHASE_ENCODE] = "encode",
+};
+
+const char *phase_name(Phase phase) {
+  NOB_ASSERT(0 <= phase && phase < COUNT_PHASES);
+  return phase_names[phase];
+}
+
+static uint64_t carve_now_ns(void) {
+  struct timespec tp = {0};
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+static bool carve_perf_read(Carve_Perf *perf,
+                            uint64_t counters[COUNT_PERF_COUNTERS]) {
+  // PERF_FORMAT_GROUP: the number of events followed by their values
+  uint64_t values[1 + COUNT_PERF_COUNTERS];
+  if (read(perf->fds[0], values, sizeof(values)) != sizeof(values))
+    return false;
+  memcpy(counters, values + 1, sizeof(*counters) * COUNT_PERF_COUNTERS);
+  return true;
+}
+
+uint64_t phase_begin(Carve_Stats *stats, Phase phase) {
+  if (stats == NULL)
+    return 0;
+  if (stats->perf != NULL)
+    carve_perf_read(stats->perf, stats->perf->begin[phase]);
+  return carve_now_ns();
+}
+
+void phase_end(Carve_Stats *stats, Phase phase, uint64_t begin,
+               uint64_t pixels) {
+  if (stats == NULL)
+    return;
+  uint64_t end = carve_now_ns();
+  nob_da_append(&stats->samples[phase], end - begin);
+  stats->pixels[phase] += pixels;
+
+  Carve_Perf *perf = stats->perf;
+  uint64_t counters[COUNT_PERF_COUNTERS];
+  if (perf != NULL && carve_perf_read(perf, counters)) {
+    for (int i = 0; i < COUNT_PERF_COUNTERS; i++)
+      perf->totals[phase][i] += counters[i] - perf->begin[phase][i];
+  }
+
+  Carve_Trace *trace = stats->trace;
+  if (trace == NULL)
+    return;
+  if (stats->tid == 0)
+    stats->tid = syscall(SYS_gettid);
+  char event[256];
+  int n = snprintf(event, sizeof(event),
+                   "{\"name\":\"%s\",\"cat\":\"carve\",\"ph\":\"X\","
+                   "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld},\n",
+                   phase_name(phase), (begin - trace->origin) / 1e3,
+                   (end - begin) / 1e3, (int)getpid(), stats->tid);
+  nob_sb_append_buf(&stats->events, event, n);
+  if (stats->events.count > (1 << 20))
+    carve_stats_flush(stats);
+}
+
+void carve_stats_flush(Carve_Stats *stats) {
+  Carve_Trace *trace = stats->trace;
+  if (trace == NULL || stats->events.count == 0)
+    return;
+  pthread_mutex_lock(&trace->lock);
+  if (trace->file != NULL) {
+    fwrite(stats->events.items, 1, stats->events.count, trace->file);
+    fflush(trace->file);
+  }
+  pthread_mutex_unlock(&trace->lock);
+  stats->events.count = 0;
+}
+
+bool carve_perf_open(Carve_Perf *perf) {
+  memset(perf, 0, sizeof(*perf));
+#ifdef __linux__
+  static const struct {
+    uint32_t type;
+    uint64_t config;
+  } events[COUNT_PERF_COUNTERS] = {
+      [PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      [PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      [PERF_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+      [PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE,
+                              PERF_COUNT_HW_BRANCH_MISSES},
+  };
+  for (int i = 0; i < COUNT_PERF_COUNTERS; i++) {
+    struct perf_event_attr attr = {
+        .type = events[i].type,
+        .size = sizeof(attr),
+        .config = events[i].config,
+        .disabled = i == 0,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+        .read_format = PERF_FORMAT_GROUP,
+    };
+    int group = i == 0 ? -1 : perf->fds[0];
+    perf->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    if (perf->fds[i] < 0) {
+      nob_log(NOB_WARNING, "perf_event_open failed for counter %d: %s", i,
+              str_err_no);
+      for (int j = 0; j < i; j++)
+        close(perf->fds[j]);
+      return false;
+    }
+  }
+  ioctl(perf->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(perf->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+#else
+  nob_log(NOB_WARNING, "hardware counters are only supported on linux");
+  return false;
+#endif
+}
+
+void carve_perf_close(Carve_Perf *perf) {
+  for (int i = 0; i < COUNT_PERF_COUNTERS; i++)
+    close(perf->fds[i]);
+}
+
+void carve_perf_report(Carve_Stats *stats) {
+  Carve_Perf *perf = stats->perf;
+  nob_log(NOB_INFO, "%-16s %12s %8s %14s %14s", "phase", "cycles/px", "ipc",
+          "llc miss/kpx", "br miss/kpx");
+  for (int phase = 0; phase < COUNT_PHASES; phase++) {
+    uint64_t *c = perf->totals[phase];
+    double px = stats->pixels[phase];
+    if (px == 0 || c[PERF_CYCLES] == 0)
+      continue;
+    nob_log(NOB_INFO, "%-16s %12.3f %8.3f %14.3f %14.3f", phase_name(phase),
+            c[PERF_CYCLES] / px,
+            (double)c[PERF_INSTRUCTIONS] / c[PERF_CYCLES],
+            c[PERF_LLC_MISSES] * 1e3 / px, c[PERF_BRANCH_MISSES] * 1e3 / px);
+  }
+}
+
+bool carve_trace_open(Carve_Trace *trace, const char *path) {
+  trace->file = fopen(path, "wb");
+  if (trace->file == NULL) {
+    nob_log(NOB_ERROR, "could not open trace file %s: %s", path, str_err_no);
+    return false;
+  }
+  trace->origin = carve_now_ns();
+  pthread_mutex_init(&trace->lock, NULL);
+  fputs("[\n", trace->file);
+  return true;
+}
+
+// Every event ends with a comma, so the array is closed with a metadata
+// event naming the process.
+void carve_trace_close(Carve_Trace *trace) {
+  pthread_mutex_lock(&trace->lock);
+  fprintf(trace->file,
+          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+          "\"args\":{\"name\":\"seam-carving\"}}\n]\n",
+          (int)getpid());
+  fclose(trace->file);
+  trace->file = NULL;
+  pthread_mutex_unlock(&trace->lock);
+}
+
+static int u64_compare(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+void carve_stats_report(Carve_Stats *stats) {
+  nob_log(NOB_INFO, "%-16s %8s %12s %12s %12s", "phase", "runs", "total ms",
+          "mean us", "p99 us");
+  for (int phase = 0; phase < COUNT_PHASES; phase++) {
+    Phase_Samples *samples = &stats->samples[phase];
+    if (samples->count == 0)
+      continue;
+    uint64_t total = 0;
+    for (size_t i = 0; i < samples->count; i++)
+      total += samples->items[i];
+    qsort(samples->items, samples->count, sizeof(*samples->items),
+          u64_compare);
+    size_t p99 = (samples->count * 99 + 99) / 100 - 1;
+    nob_log(NOB_INFO, "%-16s %8zu %12.3f %12.3f %12.3f", phase_name(phase),
+            samples->count, total / 1e6, total / 1e3 / samples->count,
+            samples->items[p99] / 1e3);
+  }
+}
+
+void carve_stats_free(Carve_Stats *stats) {
+  carve_stats_flush(stats);
+  for (int phase = 0; phase < COUNT_PHASES; phase++)
+    nob_da_free(stats->samples[phase]);
+  nob_sb_free(stats->events);
+  memset(stats, 0, sizeof(*stats));
+}
+
+static double raster_channel(Pixel_Depth depth, const uint8_t *row, int i) {
+  switch (depth) {
+  case DEPTH_8:
+    return row[i];
+  case DEPTH_16:
+    return ((const uint16_t *)row)[i];
+  case DEPTH_FLOAT:
+    return ((const float *)row)[i];
+  default:
+    NOB_ASSERT(0 && "unreachable");
+    return 0;
+  }
+}
+
+// Lumas are weighted in double and scaled down to [0, 1] after, linear
+// light is weighted in float from the decoded samples. Gray pixels go in as
+// R = G = B so they get the same luminance as their RGB expansion would.
+static void rgb_to_lum(Raster img, Lum_Model model, Mat lum) {
+  NOB_ASSERT(MAT_SAME_DIM(img, lum) &&
+             "target and source must be of same size");
+  static const double scale[COUNT_DEPTHS] = {
+      [DEPTH_8] = 255.0,
+      [DEPTH_16] = 65535.0,
+      [DEPTH_FLOAT] = 1.0,
+  };
+  double w[3];
+  lum_weights(model, w);
+  bool linear = model == LUM_LINEAR || model == LUM_LAB;
+  const float *decode = linear && img.depth != DEPTH_FLOAT
+                            ? srgb_decode_table(img.depth)
+                            : NULL;
+  int n = img.channels, g = n < 3 ? 0 : 1, b = n < 3 ? 0 : 2;
+  for (int y = 0; y < img.height; y++) {
+    const uint8_t *row = raster_row(img, y);
+    for (int x = 0; x < img.width; x++) {
+      double red = raster_channel(img.depth, row, n * x);
+      double green = raster_channel(img.depth, row, n * x + g);
+      double blue = raster_channel(img.depth, row, n * x + b);
+      float v;
+      if (!linear) {
+        v = (w[0] * red + w[1] * green + w[2] * blue) / scale[img.depth];
+      } else {
+        float r = decode ? decode[(int)red] : red;
+        float gr = decode ? decode[(int)green] : green;
+        float bl = decode ? decode[(int)blue] : blue;
+        v = (float)w[0] * r + (float)w[1] * gr + (float)w[2] * bl;
+      }
+      MAT_AT(lum, y, x) = model == LUM_LAB ? lab_lightness(v) : v;
+    }
+  }
+}
+
+static const int sobel_kernel[3][3] = {{1, 0, -1}, {2, 0, -2}, {1, 0, -1}};
+static const int scharr_kernel[3][3] = {{3, 0, -3}, {10, 0, -10}, {3, 0, -3}};
+
+// Magnitude of the gradient from a kernel for x and its transpose for y,
+// taps outside of the image are skipped.
+static float gradient_at(Mat lum, const int krnl[3][3], int row, int col) {
+  float vx = 0.0, vy = 0.0;
+  for (int ci = -1; ci < 2; ci++) {
+    for (int cj = -1; cj < 2; cj++) {
+      if (MAT_WITHIN(lum, row + ci, col + cj)) {
+        vx += krnl[ci + 1][cj + 1] * MAT_AT(lum, row + ci, col + cj);
+        vy += krnl[cj + 1][ci + 1] * MAT_AT(lum, row + ci, col + cj);
+      }
+    }
+  }
+  return sqrtf((vx * vx + vy * vy));
+}
+
+// Channel c of a pixel scaled to [0, 1] like the luminance, floats as they
+// are.
+static float raster_sample(Raster img, int row, int col, int c) {
+  static const float scale[COUNT_DEPTHS] = {
+      [DEPTH_8] = 255.0f,
+      [DEPTH_16] = 65535.0f,
+      [DEPTH_FLOAT] = 1.0f,
+  };
+  double v = raster_channel(img.depth, raster_row(img, row),
+                            img.channels * col + c);
+  return (float)v / scale[img.depth];
+}
+
+// The sobel magnitude of every color channel of img, summed up or the
+// largest.
+static float color_sobel_at(Raster img, Energy_Kind energy, int row,
+                            int col) {
+  float total = 0.0f;
+  for (int c = 0; c < color_channels(img); c++) {
+    float vx = 0.0, vy = 0.0;
+    for (int ci = -1; ci < 2; ci++) {
+      for (int cj = -1; cj < 2; cj++) {
+        if (MAT_WITHIN(img, row + ci, col + cj)) {
+          float v = raster_sample(img, row + ci, col + cj, c);
+          vx += sobel_kernel[ci + 1][cj + 1] * v;
+          vy += sobel_kernel[cj + 1][ci + 1] * v;
+        }
+      }
+    }
+    float magnitude = sqrtf((vx * vx + vy * vy));
+    if (energy == ENERGY_COLOR_MAX)
+      total = magnitude > total ? magnitude : total;
+    else
+      total = total + magnitude;
+  }
+  return total;
+}
+
+// The energy of one pixel, one function per Energy_Kind.
+static float sobel_at(Raster img, Mat lum, int row, int col) {
+  (void)img;
+  return gradient_at(lum, sobel_kernel, row, col);
+}
+
+static float scharr_at(Raster img, Mat lum, int row, int col) {
+  (void)img;
+  return gradient_at(lum, scharr_kernel, row, col);
+}
+
+static float l1_at(Raster img, Mat lum, int row, int col) {
+  (void)img;
+  float left = MAT_WITHIN(lum, row, col - 1) ? MAT_AT(lum, row, col - 1) : 0;
+  float right = MAT_WITHIN(lum, row, col + 1) ? MAT_AT(lum, row, col + 1) : 0;
+  float above = MAT_WITHIN(lum, row - 1, col) ? MAT_AT(lum, row - 1, col) : 0;
+  float below = MAT_WITHIN(lum, row + 1, col) ? MAT_AT(lum, row + 1, col) : 0;
+  return fabsf(right - left) + fabsf(below - above);
+}
+
+static float external_at(Raster img, Mat lum, int row, int col) {
+  (void)img;
+  return MAT_AT(lum, row, col);
+}
+
+static float color_at(Raster img, Mat lum, int row, int col) {
+  (void)lum;
+  return color_sobel_at(img, ENERGY_COLOR, row, col);
+}
+
+static float color_max_at(Raster img, Mat lum, int row, int col) {
+  (void)lum;
+  return color_sobel_at(img, ENERGY_COLOR_MAX, row, col);
+}
+
+// The full pass of an energy, the refresh around a removed vertical seam
+// and the one around a removed horizontal seam, each a copy of its own with
+// name##_at called directly. The refresh covers the four columns (or rows)
+// whose 3x3 neighbourhood the seam went through.
+#define CARVE_ENERGY(name)                                                     \
+  static float name##_masked_at(Raster img, Mat lum, Mask mask, int row,       \
+                                int col) {                                     \
+    float e = name##_at(img, lum, row, col);                                   \
+    return mask.items ? mask_energy(e, MAT_AT(mask, row, col)) : e;            \
+  }                                                                            \
+                                                                               \
+  static void name##_filter(Raster img, Mat lum, Mask mask, Mat grad,          \
+                            const float *zeros) {                              \
+    (void)zeros;                                                               \
+    NOB_ASSERT((MAT_SAME_DIM(lum, grad) || MAT_SAME_DIM(img, grad)) &&         \
+               "target and source must be of same size");                      \
+    for (int y = 0; y < grad.height; y++) {                                    \
+      for (int x = 0; x < grad.width; x++) {                                   \
+        MAT_AT(grad, y, x) = name##_masked_at(img, lum, mask, y, x);           \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void name##_update(const int *seam, Raster img, Mat lum, Mat edges,   \
+                            Mask mask, int *lo, int *hi,                       \
+                            const float *zeros) {                              \
+    (void)zeros;                                                               \
+    for (int y = 0; y < edges.height; y++) {                                   \
+      for (int dx = -2; dx < 2; dx++) {                                        \
+        if (seam[y] + dx >= 0 && seam[y] + dx < edges.width) {                 \
+          MAT_AT(edges, y, seam[y] + dx) =                                     \
+              name##_masked_at(img, lum, mask, y, seam[y] + dx);               \
+        }                                                                      \
+      }                                                                        \
+      if (lo != NULL) {                                                        \
+        lo[y] = seam[y] - 2 < 0 ? 0 : seam[y] - 2;                             \
+        hi[y] = seam[y] + 1 >= edges.width ? edges.width - 1 : seam[y] + 1;    \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void name##_update_horizontal(const int *seam, Raster img, Mat lum,   \
+                                       Mat edges, Mask mask) {                 \
+    for (int x = 0; x < edges.width; x++) {                                    \
+      for (int dy = -2; dy < 2; dy++) {                                        \
+        int y = seam[x] + dy;                                                  \
+        if (y >= 0 && y < edges.height)                                        \
+          MAT_AT(edges, y, x) = name##_masked_at(img, lum, mask, y, x);        \
+      }                                                                        \
+    }                                                                          \
+  }
+
+CARVE_ENERGY(sobel)
+CARVE_ENERGY(scharr)
+CARVE_ENERGY(l1)
+CARVE_ENERGY(external)
+CARVE_ENERGY(color)
+CARVE_ENERGY(color_max)
+
+// The refresh around a horizontal seam of every energy, only the reference
+// has them.
+static void (*const energy_updates_horizontal[COUNT_ENERGIES])(
+    const int *seam, Raster img, Mat lum, Mat edges, Mask mask) = {
+    [ENERGY_SOBEL] = sobel_update_horizontal,
+    [ENERGY_COLOR] = color_update_horizontal,
+    [ENERGY_COLOR_MAX] = color_max_update_horizontal,
+    [ENERGY_SCHARR] = scharr_update_horizontal,
+    [ENERGY_L1] = l1_update_horizontal,
+    [ENERGY_EXTERNAL] = external_update_horizontal,
+};
+
+// The color energies are taken straight from the pixels, every other one
+// reads the luminance, or the map standing in for it.
+static bool energy_reads_lum(Energy_Kind energy) {
+  return energy != ENERGY_COLOR && energy != ENERGY_COLOR_MAX;
+}
+
+static void continue_dp(const float *prev, Mat mat, Mat dp) {
+  NOB_ASSERT(MAT_SAME_DIM(mat, dp) && "target and source must be of same size");
+  for (int y = 0; y < mat.height; y++) {
+    const float *above = y > 0 ? &MAT_AT(dp, y - 1, 0) : prev;
+    for (int x = 0; x < mat.width; x++) {
+      if (above == NULL) {
+        MAT_AT(dp, y, x) = MAT_AT(mat, y, x);
+        continue;
+      }
+      float min_prev = FLT_MAX;
+      for (int i = -1; i < 2; i++) {
+        if (x + i >= 0 && x + i < mat.width && min_prev > above[x + i]) {
+          min_prev = above[x + i];
+        }
+      }
+      MAT_AT(dp, y, x) = MAT_AT(mat, y, x) + min_prev;
+    }
+  }
+}
+
+static void build_dp(Mat mat, Mat dp) { continue_dp(NULL, mat, dp); }
+
+// Bytes per row of the steps of build_dirs, four pixels to a byte.
+static int dirs_stride(int width) { return (width + 3) / 4; }
+
+// build_dp for DP_ROLLING, only two rows of the dp are ever kept. Every
+// pixel from the second row on stores the step to its parent in the row
+// above as dx + 1 in 2 bits, with the same preference as find_seam on ties:
+// straight up, then left, then right. *last is the leftmost cheapest column
+// of the last row, whose cost is returned.
+static float build_dirs(Mat mat, uint8_t *dirs, int *last, float *scratch) {
+  int width = mat.width, stride = dirs_stride(width);
+  float *prev = scratch, *cur = scratch + width;
+  memcpy(prev, &MAT_AT(mat, 0, 0), width * sizeof(float));
+  for (int y = 1; y < mat.height; y++) {
+    uint8_t *d = dirs + (size_t)y * stride;
+    memset(d, 0, stride);
+    for (int x = 0; x < width; x++) {
+      int parent = x;
+      if (x > 0 && prev[x - 1] < prev[parent])
+        parent = x - 1;
+      if (x + 1 < width && prev[x + 1] < prev[parent])
+        parent = x + 1;
+      cur[x] = MAT_AT(mat, y, x) + prev[parent];
+      d[x / 4] |= (parent - x + 1) << (2 * (x % 4));
+    }
+    float *t = prev;
+    prev = cur;
+    cur = t;
+  }
+  int x = 0;
+  for (int i = 0; i < width; i++) {
+    if (prev[x] > prev[i])
+      x = i;
+  }
+  *last = x;
+  return prev[x];
+}
+
+// find_seam along the steps stored by build_dirs.
+static void find_seam_dirs(const uint8_t *dirs, int width, int height,
+                           int last, int *seam) {
+  int stride = dirs_stride(width);
+  int x = last;
+  seam[height - 1] = x;
+  for (int y = height - 1; y > 0; y--) {
+    uint8_t d = dirs[(size_t)y * stride + x / 4];
+    x += ((d >> (2 * (x % 4))) & 3) - 1;
+    seam[y - 1] = x;
+  }
+}
+
+static void mat_rm_col_at_row(Mat mat, int row, int col) {
+  float *mat_row = &MAT_AT(mat, row, 0);
+  memmove(mat_row + col, mat_row + col + 1,
+          (mat.width - col - 1) * sizeof(float));
+}
+
+static void mat_remove_seam(const int *seam, Mat mat) {
+  for (int y = 0; y < mat.height; y++)
+    mat_rm_col_at_row(mat, y, seam[y]);
+}
+
+static void mask_rm_col_at_row(Mask mask, int row, int col) {
+  uint8_t *mask_row = &MAT_AT(mask, row, 0);
+  memmove(mask_row + col, mask_row + col + 1, mask.width - col - 1);
+}
+
+static void img_rm_col_at_row(Raster img, int row, int col) {
+  size_t size = raster_pixel_size(img);
+  uint8_t *pixel_row = raster_row(img, row);
+  memmove(pixel_row + col * size, pixel_row + (col + 1) * size,
+          (img.width - col - 1) * size);
+}
+
+// One step of the backtrack of find_seam: the column in the row above x.
+static int seam_step(const float *above, int width, int x) {
+  int prev = x;
+  for (int dx = -1; dx < 2; dx++) {
+    if (prev + dx >= 0 && prev + dx < width && above[x] > above[prev + dx])
+      x = prev + dx;
+  }
+  return x;
+}
+
+// Follows the dp plane back up from the cheapest cell of the last row and
+// stores the column of the seam for every row.
+static void find_seam(Mat dp, int *seam) {
+  int y = dp.height - 1;
+  int x = 0;
+
+  for (int i = 0; i < dp.width; i++) {
+    if (MAT_AT(dp, y, x) > MAT_AT(dp, y, i)) {
+      x = i;
+    }
+  }
+  seam[y] = x;
+
+  while (y--) {
+    int prev = x;
+    for (int dx = -1; dx < 2; dx++) {
+      if (prev + dx >= 0 && prev + dx < dp.width &&
+          MAT_AT(dp, y, x) > MAT_AT(dp, y, prev + dx)) {
+        x = prev + dx;
+      }
+    }
+    seam[y] = x;
+  }
+}
+
+static int remove_seam(const int *seam, Raster img, Mat lum, Mat edges,
+                       Mask mask) {
+  int removed = 0;
+  for (int y = 0; y < img.height; y++) {
+    img_rm_col_at_row(img, y, seam[y]);
+    if (lum.items)
+      mat_rm_col_at_row(lum, y, seam[y]);
+    mat_rm_col_at_row(edges, y, seam[y]);
+    if (mask.items) {
+      removed += MAT_AT(mask, y, seam[y]) == MASK_REMOVE;
+      mask_rm_col_at_row(mask, y, seam[y]);
+    }
+  }
+  return removed;
+}
+
+// Brings a dp plane built before a seam was removed up to date with the
+// energy after it. Every row is shifted over the seam like the other planes,
+// then only the columns in lo..hi, where the energy changed or the seam
+// moved the neighbours around, and the ones below a value that actually
+// changed in the row above are computed again. The changes usually die out
+// within a few columns of the seam, so this touches a thin cone instead of
+// the whole plane, and gives the same values as build_dp.
+static void update_dp(Mat edges, Mat dp, const int *seam, const int *lo,
+                      const int *hi, float *scratch) {
+  (void)scratch;
+  NOB_ASSERT(MAT_SAME_DIM(edges, dp) &&
+             "target and source must be of same size");
+  int width = edges.width;
+  // columns of the row above whose value changed, empty when from > to
+  int from = 0, to = -1;
+  for (int y = 0; y < edges.height; y++) {
+    float *row = &MAT_AT(dp, y, 0);
+    memmove(row + seam[y], row + seam[y] + 1,
+            (width - seam[y]) * sizeof(float));
+    int a = lo[y], b = hi[y];
+    if (from <= to) {
+      a = from - 1 < a ? from - 1 : a;
+      b = to + 1 > b ? to + 1 : b;
+    }
+    a = a < 0 ? 0 : a;
+    b = b >= width ? width - 1 : b;
+    from = width;
+    to = -1;
+    const float *energy = &MAT_AT(edges, y, 0);
+    const float *prev = y > 0 ? &MAT_AT(dp, y - 1, 0) : NULL;
+    for (int x = a; x <= b; x++) {
+      float value = energy[x];
+      if (prev != NULL) {
+        float m = prev[x];
+        if (x > 0 && prev[x - 1] < m)
+          m = prev[x - 1];
+        if (x + 1 < width && prev[x + 1] < m)
+          m = prev[x + 1];
+        value += m;
+      }
+      if (value != row[x]) {
+        row[x] = value;
+        from = x < from ? x : from;
+        to = x;
+      }
+    }
+  }
+}
+
+// Writes the transpose of src into dst, in tiles so that both sides stay in
+// cache.
+static void mat_transpose(Mat src, Mat dst) {
+  NOB_ASSERT(src.width == dst.height && src.height == dst.width &&
+             "target must have the transposed size of the source");
+  enum { TILE = 32 };
+  for (int y0 = 0; y0 < src.height; y0 += TILE) {
+    for (int x0 = 0; x0 < src.width; x0 += TILE) {
+      int y1 = y0 + TILE < src.height ? y0 + TILE : src.height;
+      int x1 = x0 + TILE < src.width ? x0 + TILE : src.width;
+      for (int x = x0; x < x1; x++) {
+        for (int y = y0; y < y1; y++) {
+          MAT_AT(dst, x, y) = MAT_AT(src, y, x);
+        }
+      }
+    }
+  }
+}
+
+// The cheapest horizontal seam of mat is the vertical seam of its transpose,
+// so the dp runs on the transposed energy in place and with the same kernels
+// as the vertical seams. dp needs room for width * height floats, seam gets
+// the row of every column. Returns the cost of the seam.
+static float find_seam_horizontal(const Kernels *k, Mat mat, float *dp,
+                                  int *seam) {
+  Mat t = {
+      .height = mat.width,
+      .width = mat.height,
+      .stride = mat.height,
+      .items = dp,
+  };
+  mat_transpose(mat, t);
+  k->build_dp(t, t);
+  find_seam(t, seam);
+  return MAT_AT(t, t.height - 1, seam[t.height - 1]);
+}
+
+// Moves everything below the seam up by one row. Going through the planes
+// row by row keeps the copies sequential even though every column only
+// shifts below its own seam row, and rows above the highest point of the
+// seam stay as they are. Returns the removed MASK_REMOVE pixels, like
+// remove_seam.
+static int remove_seam_horizontal(const int *seam, Raster img, Mat lum,
+                                  Mat edges, Mask mask) {
+  int top = img.height, removed = 0;
+  for (int x = 0; x < img.width; x++) {
+    top = seam[x] < top ? seam[x] : top;
+    if (mask.items)
+      removed += MAT_AT(mask, seam[x], x) == MASK_REMOVE;
+  }
+  size_t size = raster_pixel_size(img);
+  for (int y = top; y + 1 < img.height; y++) {
+    float *e = &MAT_AT(edges, y, 0);
+    const float *e_below = &MAT_AT(edges, y + 1, 0);
+    if (size == sizeof(uint32_t)) {
+      uint32_t *px = (uint32_t *)raster_row(img, y);
+      const uint32_t *px_below = (const uint32_t *)raster_row(img, y + 1);
+      for (int x = 0; x < img.width; x++) {
+        bool shift = y >= seam[x];
+        px[x] = shift ? px_below[x] : px[x];
+        e[x] = shift ? e_below[x] : e[x];
+      }
+    } else {
+      uint8_t *px = raster_row(img, y);
+      const uint8_t *px_below = raster_row(img, y + 1);
+      for (int x = 0; x < img.width; x++) {
+        if (y >= seam[x]) {
+          memcpy(px + x * size, px_below + x * size, size);
+          e[x] = e_below[x];
+        }
+      }
+    }
+    if (lum.items) {
+      float *l = &MAT_AT(lum, y, 0);
+      const float *l_below = &MAT_AT(lum, y + 1, 0);
+      for (int x = 0; x < img.width; x++)
+        l[x] = y >= seam[x] ? l_below[x] : l[x];
+    }
+    if (mask.items) {
+      uint8_t *m = &MAT_AT(mask, y, 0);
+      const uint8_t *m_below = &MAT_AT(mask, y + 1, 0);
+      for (int x = 0; x < img.width; x++)
+        m[x] = y >= seam[x] ? m_below[x] : m[x];
+    }
+  }
+  return removed;
+}
+
+static void mat_remove_seam_horizontal(const int *seam, Mat mat) {
+  for (int y = 0; y + 1 < mat.height; y++) {
+    for (int x = 0; x < mat.width; x++) {
+      if (y >= seam[x])
+        MAT_AT(mat, y, x) = MAT_AT(mat, y + 1, x);
+    }
+  }
+}
+
+// build_dp restricted to the columns lo[y]..hi[y] of every row. Cells outside
+// of the band are never read or written; cells inside it that cannot be
+// reached from the band of the row above end up at FLT_MAX or more.
+static void build_dp_band(Mat mat, Mat dp, const int *lo, const int *hi) {
+  NOB_ASSERT(MAT_SAME_DIM(mat, dp) && "target and source must be of same size");
+  for (int x = lo[0]; x <= hi[0]; x++) {
+    MAT_AT(dp, 0, x) = MAT_AT(mat, 0, x);
+  }
+  for (int y = 1; y < mat.height; y++) {
+    const float *prev = &MAT_AT(dp, y - 1, 0);
+    const float *energy = &MAT_AT(mat, y, 0);
+    float *dst = &MAT_AT(dp, y, 0);
+    // cells in [inner_lo, inner_hi] have all three parents inside the band
+    int inner_lo = lo[y - 1] + 1 > lo[y] ? lo[y - 1] + 1 : lo[y];
+    int inner_hi = hi[y - 1] - 1 < hi[y] ? hi[y - 1] - 1 : hi[y];
+    for (int x = lo[y]; x <= hi[y]; x++) {
+      if (x == inner_lo && inner_lo <= inner_hi) {
+        for (; x <= inner_hi; x++) {
+          float m = prev[x] < prev[x - 1] ? prev[x] : prev[x - 1];
+          m = prev[x + 1] < m ? prev[x + 1] : m;
+          dst[x] = energy[x] + m;
+        }
+        if (x > hi[y])
+          break;
+      }
+      float min_prev = FLT_MAX;
+      for (int i = -1; i < 2; i++) {
+        if (x + i >= lo[y - 1] && x + i <= hi[y - 1] &&
+            min_prev > prev[x + i]) {
+          min_prev = prev[x + i];
+        }
+      }
+      dst[x] = min_prev == FLT_MAX ? FLT_MAX : energy[x] + min_prev;
+    }
+  }
+}
+
+// find_seam within the band of build_dp_band, breaking ties the same way.
+static void find_seam_band(Mat dp, const int *lo, const int *hi, int *seam) {
+  int y = dp.height - 1;
+  int x = lo[y];
+
+  for (int i = lo[y]; i <= hi[y]; i++) {
+    if (MAT_AT(dp, y, x) > MAT_AT(dp, y, i)) {
+      x = i;
+    }
+  }
+  seam[y] = x;
+
+  while (y--) {
+    int prev = x;
+    x = -1;
+    static const int order[] = {0, -1, 1};
+    for (int i = 0; i < 3; i++) {
+      int c = prev + order[i];
+      if (c >= lo[y] && c <= hi[y] &&
+          (x < 0 || MAT_AT(dp, y, x) > MAT_AT(dp, y, c))) {
+        x = c;
+      }
+    }
+    NOB_ASSERT(x >= 0 && "seam left the band");
+    seam[y] = x;
+  }
+}
+
+static bool kernels_scalar_supported(void) { return true; }
+
+const Kernels kernels_scalar = {
+    .name = "scalar",
+    .supported = kernels_scalar_supported,
+    .rgb_to_lum = rgb_to_lum,
+    .build_dp = build_dp,
+    .continue_dp = continue_dp,
+    .build_dirs = build_dirs,
+    .remove_seam = remove_seam,
+    .update_dp = update_dp,
+    .energies =
+        {
+            [ENERGY_SOBEL] = {sobel_filter, sobel_update},
+            [ENERGY_COLOR] = {color_filter, color_update},
+            [ENERGY_COLOR_MAX] = {color_max_filter, color_max_update},
+            [ENERGY_SCHARR] = {scharr_filter, scharr_update},
+            [ENERGY_L1] = {l1_filter, l1_update},
+            [ENERGY_EXTERNAL] = {external_filter, external_update},
+        },
+};
+
+// Ordered from slowest to fastest.
+const Kernels *const carve_kernels[] = {
+    &kernels_scalar,
+#ifdef CARVE_SIMD
+    &kernels_sse2,
+    &kernels_avx2,
+    &kernels_avx512,
+#endif
+};
+const size_t carve_kernels_count = NOB_ARRAY_LEN(carve_kernels);
+
+const Kernels *kernels_select(const char *name) {
+  for (size_t i = carve_kernels_count; i-- > 0;) {
+    const Kernels *k = carve_kernels[i];
+    if (name == NULL && k->supported())
+      return k;
+    if (name != NULL && strcmp(name, k->name) == 0) {
+      if (k->supported())
+        return k;
+      nob_log(NOB_ERROR, "this cpu cannot run the %s kernels", name);
+      return NULL;
+    }
+  }
+  if (name != NULL)
+    nob_log(NOB_ERROR, "unknown kernels: %s", name);
+  return NULL;
+}
+
+static Mat carve_arena_mat(Carve_Arena *arena, int index, int height,
+                           int width) {
+  Mat mat = {
+      .height = height,
+      .width = width,
+      .stride = width,
+      .items = arena->items + (size_t)index * width * height,
+  };
+  return mat;
+}
+
+static void carve_arena_reserve(Carve_Arena *arena, size_t count) {
+  if (arena->capacity < count) {
+    arena->items = NOB_REALLOC(arena->items, count * sizeof(float));
+    NOB_ASSERT(arena->items != NULL && "buy more ram lol");
+    arena->capacity = count;
+  }
+}
+
+void carve_arena_free(Carve_Arena *arena) {
+  NOB_FREE(arena->items);
+  arena->items = NULL;
+  arena->capacity = 0;
+}
+
+#define SEAM_STREAM_MAGIC 0x52545353 // "SSTR"
+#define SEAM_STREAM_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t seams;
+} Seam_Stream_Header;
+
+static size_t seam_stream_record_size(int height) {
+  return sizeof(uint32_t) + (height - 1 + 3) / 4;
+}
+
+void seam_stream_begin(Seam_Stream *stream, int width, int height) {
+  stream->width = width;
+  stream->height = height;
+  stream->seams = 0;
+  stream->count = 0;
+}
+
+void seam_stream_push(Seam_Stream *stream, const int *seam) {
+  size_t record = seam_stream_record_size(stream->height);
+  if (stream->count + record > stream->capacity) {
+    stream->capacity = stream->capacity * 2 + record;
+    stream->items = NOB_REALLOC(stream->items, stream->capacity);
+    NOB_ASSERT(stream->items != NULL && "buy more ram lol");
+  }
+  uint8_t *dst = stream->items + stream->count;
+  memset(dst, 0, record);
+  uint32_t start = seam[0];
+  memcpy(dst, &start, sizeof(start));
+  uint8_t *steps = dst + sizeof(start);
+  for (int y = 1; y < stream->height; y++) {
+    int step = seam[y] - seam[y - 1];
+    NOB_ASSERT(-1 <= step && step <= 1 && "seam is not connected");
+    steps[(y - 1) / 4] |= (step + 1) << (2 * ((y - 1) % 4));
+  }
+  stream->count += record;
+  stream->seams++;
+}
+
+bool seam_stream_save(const Seam_Stream *stream, const char *path) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    nob_log(NOB_ERROR, "could not open %s: %s", path, str_err_no);
+    return false;
+  }
+  Seam_Stream_Header header = {
+      .magic = SEAM_STREAM_MAGIC,
+      .version = SEAM_STREAM_VERSION,
+      .width = stream->width,
+      .height = stream->height,
+      .seams = stream->seams,
+  };
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(stream->items, 1, stream->count, f) == stream->count;
+  if (fclose(f) != 0 || !ok) {
+    nob_log(NOB_ERROR, "could not write %s: %s", path, str_err_no);
+    return false;
+  }
+  return true;
+}
+
+// Every seam must start inside the image, step by -1, 0 or +1 only and stay
+// within the columns left once the seams before it are gone.
+static bool seam_stream_valid(const Seam_Stream *stream) {
+  size_t record = seam_stream_record_size(stream->height);
+  for (int i = 0; i < stream->seams; i++) {
+    const uint8_t *src = stream->items + (size_t)i * record;
+    uint32_t width = stream->width - i, col;
+    memcpy(&col, src, sizeof(col));
+    if (col >= width)
+      return false;
+    const uint8_t *steps = src + sizeof(uint32_t);
+    for (int y = 1; y < stream->height; y++) {
+      int step = (steps[(y - 1) / 4] >> (2 * ((y - 1) % 4))) & 3;
+      // a step off column 0 wraps around and fails the bounds check too
+      col += step - 1;
+      if (step == 3 || col >= width)
+        return false;
+    }
+  }
+  return true;
+}
+
+bool seam_stream_load(Seam_Stream *stream, const char *path) {
+  NOB_String_Builder sb = {0};
+  if (!nob_read_entire_file(path, &sb))
+    return false;
+  Seam_Stream_Header header = {0};
+  if (sb.count >= sizeof(header))
+    memcpy(&header, sb.items, sizeof(header));
+  if (header.magic != SEAM_STREAM_MAGIC ||
+      header.version != SEAM_STREAM_VERSION || header.width == 0 ||
+      header.height == 0 || header.width > INT32_MAX ||
+      header.height > INT32_MAX || header.seams >= header.width ||
+      sb.count - sizeof(header) !=
+          header.seams * seam_stream_record_size(header.height)) {
+    nob_log(NOB_ERROR, "%s is not a seam stream", path);
+    nob_sb_free(sb);
+    return false;
+  }
+  seam_stream_begin(stream, header.width, header.height);
+  nob_da_append_many(stream, (uint8_t *)sb.items + sizeof(header),
+                     sb.count - sizeof(header));
+  stream->seams = header.seams;
+  nob_sb_free(sb);
+  if (!seam_stream_valid(stream)) {
+    nob_log(NOB_ERROR, "%s has seams outside of the image", path);
+    seam_stream_free(stream);
+    return false;
+  }
+  return true;
+}
+
+void seam_stream_free(Seam_Stream *stream) {
+  nob_da_free(*stream);
+  memset(stream, 0, sizeof(*stream));
+}
+
+// Fenwick tree over the columns of a row, tree[1..width] counts the columns
+// that are still alive.
+static void fenwick_init(int *tree, int width) {
+  for (int x = 1; x <= width; x++)
+    tree[x] = 1;
+  for (int x = 1; x <= width; x++) {
+    int parent = x + (x & -x);
+    if (parent <= width)
+      tree[parent] += tree[x];
+  }
+}
+
+// Original column of the alive column with index rank.
+static int fenwick_find(const int *tree, int width, int rank) {
+  int pos = 0;
+  for (int step = 1 << (31 - __builtin_clz(width)); step > 0; step /= 2) {
+    if (pos + step <= width && tree[pos + step] <= rank) {
+      pos += step;
+      rank -= tree[pos];
+    }
+  }
+  return pos;
+}
+
+static void fenwick_remove(int *tree, int width, int x) {
+  for (x++; x <= width; x += x & -x)
+    tree[x]--;
+}
+
+// Follows every seam of the stream down to row y, cols holds their columns
+// from the row above, and stores the original column of each in orig.
+static void seam_stream_row(const Seam_Stream *stream, int y, int *cols,
+                            int *tree, int *orig) {
+  size_t record = seam_stream_record_size(stream->height);
+  fenwick_init(tree, stream->width);
+  for (int i = 0; i < stream->seams; i++) {
+    const uint8_t *src = stream->items + i * record;
+    if (y == 0) {
+      uint32_t start;
+      memcpy(&start, src, sizeof(start));
+      cols[i] = start;
+    } else {
+      const uint8_t *steps = src + sizeof(uint32_t);
+      cols[i] += ((steps[(y - 1) / 4] >> (2 * ((y - 1) % 4))) & 3) - 1;
+    }
+    NOB_ASSERT(0 <= cols[i] && cols[i] < stream->width - i &&
+               "seam stream out of bounds");
+    orig[i] = fenwick_find(tree, stream->width, cols[i]);
+    fenwick_remove(tree, stream->width, orig[i]);
+  }
+}
+
+// Every row is handled on its own: the columns of all seams are followed
+// down by one step, a fenwick tree over the columns still alive in the row
+// turns each seam's column back into an original one, and the row is then
+// compacted once.
+int seam_stream_replay(const Seam_Stream *stream, void *items, int stride,
+                       size_t size) {
+  int width = stream->width, seams = stream->seams;
+  int *cols = NOB_REALLOC(NULL, (seams + 1) * sizeof(*cols));
+  int *orig = NOB_REALLOC(NULL, (seams + 1) * sizeof(*orig));
+  int *tree = NOB_REALLOC(NULL, (width + 1) * sizeof(*tree));
+  uint8_t *dead = calloc(width + 1, 1);
+  NOB_ASSERT(cols != NULL && orig != NULL && tree != NULL && dead != NULL &&
+             "buy more ram lol");
+
+  for (int y = 0; y < stream->height; y++) {
+    seam_stream_row(stream, y, cols, tree, orig);
+    for (int i = 0; i < seams; i++)
+      dead[orig[i]] = 1;
+
+    uint8_t *row = (uint8_t *)items + (size_t)y * stride * size;
+    int dst = 0, run = 0;
+    for (int x = 0; x <= width; x++) {
+      if (x < width && !dead[x])
+        continue;
+      dead[x] = 0;
+      if (x > run && dst != run)
+        memmove(row + dst * size, row + run * size, (x - run) * size);
+      dst += x - run;
+      run = x + 1;
+    }
+  }
+
+  NOB_FREE(cols);
+  NOB_FREE(orig);
+  NOB_FREE(tree);
+  free(dead);
+  return width - seams;
+}
+
+int carve_rows_for(Img img, Carve_Opts opts) {
+  int rm_rows = 0;
+  if (opts.target_height > 0 && opts.target_height < img.height)
+    rm_rows = img.height - opts.target_height;
+  if (rm_rows * 3 > 2 * img.height)
+    rm_rows = (img.height * 2) / 3;
+  return rm_rows;
+}
+
+int carve_seams_for(Img img, Carve_Opts opts) {
+  int rm_seams = CARVE_DEFAULT_SEAMS;
+  if (opts.target_width > 0) {
+    rm_seams = opts.target_width < img.width ? img.width - opts.target_width
+                                             : 0;
+  }
+  if (rm_seams * 3 > 2 * img.width)
+    rm_seams = (img.width * 2) / 3;
+  return rm_seams;
+}
+
+// Everything one level of the carve works on. Proxy levels only have an
+// energy plane, their img and lum stay empty. The color energies are taken
+// straight from img, so lum stays empty for them too.
+typedef struct {
+  Raster img;
+  Mat lum;
+  Mat edges;
+  Mat dp;
+  // steps of DP_ROLLING, NULL when the full searches use dp
+  uint8_t *dirs;
+  // last row of every segment but the last for DP_CHECKPOINT, which keeps
+  // one segment of rows in dp; NULL otherwise
+  float *checkpoints;
+  Mask mask;
+  int *seam;
+  // row of every column for horizontal seams
+  int *row_seam;
+  // per row bounds of the banded dp
+  int *lo;
+  int *hi;
+  // columns the energy update rewrote in every row, for update_dp
+  int *dirty_lo;
+  int *dirty_hi;
+  // a row of zeros and three rows of scratch for the kernels, as wide as
+  // the image was
+  float *zeros;
+  float *scratch;
+  // dp holds the full dp of the current edges
+  bool dp_current;
+  // dp holds the full dp from before the last removed seam, which
+  // update_dp can catch up with
+  bool dp_stale;
+  // cost of the seam found by the last full dp
+  float best;
+  // MASK_REMOVE pixels left, counted down as seams remove them
+  int marked;
+  // the loops of the energy edges holds, picked once for the whole carve
+  Energy_Kernels energy;
+  void (*update_horizontal)(const int *seam, Raster img, Mat lum, Mat edges,
+                            Mask mask);
+  const Kernels *k;
+  Carve_Stats *stats;
+  Seam_Stream *seams;
+} Carve_Level;
+
+// Removes level->seam from the image and its planes and refreshes the energy
+// around it.
+static void carve_level_remove(Carve_Level *level, uint64_t pixels) {
+  Carve_Stats *stats = level->stats;
+  if (level->seams != NULL)
+    seam_stream_push(level->seams, level->seam);
+
+  uint64_t begin = phase_begin(stats, PHASE_COMPACTION);
+  if (level->img.items != NULL) {
+    level->marked -= level->k->remove_seam(level->seam, level->img, level->lum,
+                                           level->edges, level->mask);
+  } else {
+    mat_remove_seam(level->seam, level->edges);
+  }
+  phase_end(stats, PHASE_COMPACTION, begin, pixels);
+
+  level->img.width--;
+  level->lum.width--;
+  level->edges.width--;
+  level->dp.width--;
+  level->mask.width--;
+
+  // proxy levels keep their energy, nothing marks the dp dirty there
+  level->dp_stale = level->dp_current && level->img.items != NULL;
+  level->dp_current = false;
+  if (level->img.items != NULL) {
+    begin = phase_begin(stats, PHASE_UPDATE);
+    level->energy.update(level->seam, level->img, level->lum, level->edges,
+                         level->mask, level->dirty_lo, level->dirty_hi,
+                         level->zeros);
+    phase_end(stats, PHASE_UPDATE, begin, 4 * level->img.height);
+  }
+}
+
+// carve_level_find for DP_CHECKPOINT. The dp runs through the segments of
+// dp.height rows once to keep the last row of each, then the backtrack
+// computes every segment again from the checkpoint above it, from the
+// bottom up. The recomputed segments make the backtrack part of the dp
+// phase.
+static float carve_level_find_checkpointed(Carve_Level *level) {
+  Carve_Stats *stats = level->stats;
+  Mat edges = level->edges, dp = level->dp;
+  int width = edges.width, height = edges.height, rows = dp.height;
+  int segments = (height + rows - 1) / rows;
+  uint64_t begin = phase_begin(stats, PHASE_DP);
+  for (int s = 0; s < segments; s++) {
+    Mat mat = edges;
+    mat.items = &MAT_AT(edges, s * rows, 0);
+    mat.height = height - s * rows < rows ? height - s * rows : rows;
+    dp.height = mat.height;
+    const float *prev =
+        s > 0 ? level->checkpoints + (size_t)(s - 1) * dp.stride : NULL;
+    level->k->continue_dp(prev, mat, dp);
+    if (s + 1 < segments)
+      memcpy(level->checkpoints + (size_t)s * dp.stride,
+             &MAT_AT(dp, rows - 1, 0), width * sizeof(float));
+  }
+
+  const float *bottom = &MAT_AT(dp, dp.height - 1, 0);
+  int x = 0;
+  for (int i = 0; i < width; i++) {
+    if (bottom[x] > bottom[i])
+      x = i;
+  }
+  float cost = bottom[x];
+  int y = height - 1;
+  level->seam[y] = x;
+  for (int s = segments - 1; s >= 0; s--) {
+    if (s + 1 < segments) {
+      Mat mat = edges;
+      mat.items = &MAT_AT(edges, s * rows, 0);
+      mat.height = dp.height = rows;
+      const float *prev =
+          s > 0 ? level->checkpoints + (size_t)(s - 1) * dp.stride : NULL;
+      level->k->continue_dp(prev, mat, dp);
+    }
+    while (y > s * rows) {
+      y--;
+      x = seam_step(&MAT_AT(dp, y - s * rows, 0), width, x);
+      level->seam[y] = x;
+    }
+  }
+  phase_end(stats, PHASE_DP, begin, 2 * (uint64_t)width * height);
+  return cost;
+}
+
+// Finds the cheapest vertical seam of the whole plane and returns its cost.
+static float carve_level_find(Carve_Level *level) {
+  Carve_Stats *stats = level->stats;
+  uint64_t pixels = (uint64_t)level->edges.width * level->edges.height;
+  uint64_t begin;
+  if (level->checkpoints != NULL)
+    return carve_level_find_checkpointed(level);
+  if (level->dirs != NULL) {
+    begin = phase_begin(stats, PHASE_DP);
+    int last;
+    float cost = level->k->build_dirs(level->edges, level->dirs, &last,
+                                      level->scratch);
+    phase_end(stats, PHASE_DP, begin, pixels);
+
+    begin = phase_begin(stats, PHASE_BACKTRACK);
+    find_seam_dirs(level->dirs, level->edges.width, level->edges.height, last,
+                   level->seam);
+    phase_end(stats, PHASE_BACKTRACK, begin, level->edges.height);
+    return cost;
+  }
+
+  begin = phase_begin(stats, PHASE_DP);
+  if (level->dp_stale)
+    level->k->update_dp(level->edges, level->dp, level->seam,
+                        level->dirty_lo, level->dirty_hi, level->scratch);
+  else
+    level->k->build_dp(level->edges, level->dp);
+  level->dp_current = true;
+  level->dp_stale = false;
+  phase_end(stats, PHASE_DP, begin, pixels);
+
+  begin = phase_begin(stats, PHASE_BACKTRACK);
+  find_seam(level->dp, level->seam);
+  phase_end(stats, PHASE_BACKTRACK, begin, level->edges.height);
+  int last = level->edges.height - 1;
+  return MAT_AT(level->dp, last, level->seam[last]);
+}
+
+static void carve_level_full(Carve_Level *level) {
+  uint64_t pixels = (uint64_t)level->edges.width * level->edges.height;
+  uint64_t seam_begin = phase_begin(level->stats, PHASE_SEAM);
+  level->best = carve_level_find(level);
+  carve_level_remove(level, pixels);
+  phase_end(level->stats, PHASE_SEAM, seam_begin, pixels);
+}
+
+// carve_level_find for horizontal seams, the seam goes to level->row_seam.
+static float carve_level_find_horizontal(Carve_Level *level) {
+  Carve_Stats *stats = level->stats;
+  uint64_t pixels = (uint64_t)level->edges.width * level->edges.height;
+  uint64_t begin = phase_begin(stats, PHASE_DP);
+  level->dp_current = false;
+  float cost = find_seam_horizontal(level->k, level->edges, level->dp.items,
+                                    level->row_seam);
+  phase_end(stats, PHASE_DP, begin, pixels);
+  return cost;
+}
+
+static void carve_level_remove_horizontal(Carve_Level *level,
+                                          uint64_t pixels) {
+  Carve_Stats *stats = level->stats;
+  uint64_t begin = phase_begin(stats, PHASE_COMPACTION);
+  level->marked -=
+      remove_seam_horizontal(level->row_seam, level->img, level->lum,
+                             level->edges, level->mask);
+  phase_end(stats, PHASE_COMPACTION, begin, pixels);
+
+  level->img.height--;
+  level->lum.height--;
+  level->edges.height--;
+  level->dp.height--;
+  level->mask.height--;
+
+  begin = phase_begin(stats, PHASE_UPDATE);
+  level->update_horizontal(level->row_seam, level->img, level->lum,
+                           level->edges, level->mask);
+  phase_end(stats, PHASE_UPDATE, begin, 4 * level->img.width);
+}
+
+static void carve_level_full_horizontal(Carve_Level *level) {
+  uint64_t pixels = (uint64_t)level->edges.width * level->edges.height;
+  uint64_t seam_begin = phase_begin(level->stats, PHASE_SEAM);
+  carve_level_find_horizontal(level);
+  carve_level_remove_horizontal(level, pixels);
+  phase_end(level->stats, PHASE_SEAM, seam_begin, pixels);
+}
+
+// Finds the cheapest seam in both directions and removes the cheaper one.
+// Both searches share the dp plane, each seam is backtracked before the
+// other dp overwrites it.
+static void carve_level_greedy(Carve_Level *level, int *rm_cols,
+                               int *rm_rows) {
+  uint64_t pixels = (uint64_t)level->edges.width * level->edges.height;
+  uint64_t seam_begin = phase_begin(level->stats, PHASE_SEAM);
+  float vertical = *rm_cols > 0 ? carve_level_find(level) : FLT_MAX;
+  float horizontal =
+      *rm_rows > 0 ? carve_level_find_horizontal(level) : FLT_MAX;
+  if (vertical <= horizontal) {
+    carve_level_remove(level, pixels);
+    (*rm_cols)--;
+  } else {
+    carve_level_remove_horizontal(level, pixels);
+    (*rm_rows)--;
+  }
+  phase_end(level->stats, PHASE_SEAM, seam_begin, pixels);
+}
+
+// Searches the next seam within band columns of the one just removed, which
+// is still in level->seam. Only when the best seam in there got too
+// expensive compared to the last full dp is the whole plane searched again.
+static void carve_level_banded(Carve_Level *level, int band) {
+  Carve_Stats *stats = level->stats;
+  int width = level->edges.width, height = level->edges.height;
+  for (int y = 0; y < height; y++) {
+    int x = level->seam[y];
+    level->lo[y] = x - band < 0 ? 0 : x - band;
+    level->hi[y] = x + band >= width ? width - 1 : x + band;
+  }
+
+  uint64_t pixels = (uint64_t)width * height;
+  uint64_t seam_begin = phase_begin(stats, PHASE_SEAM);
+
+  uint64_t begin = phase_begin(stats, PHASE_DP);
+  level->dp_current = false;
+  build_dp_band(level->edges, level->dp, level->lo, level->hi);
+  phase_end(stats, PHASE_DP, begin, (uint64_t)height * (2 * band + 1));
+
+  begin = phase_begin(stats, PHASE_BACKTRACK);
+  find_seam_band(level->dp, level->lo, level->hi, level->seam);
+  phase_end(stats, PHASE_BACKTRACK, begin, height);
+
+  float cost = MAT_AT(level->dp, height - 1, level->seam[height - 1]);
+  if (cost > CARVE_BAND_SLACK * level->best)
+    level->best = carve_level_find(level);
+  carve_level_remove(level, pixels);
+  phase_end(stats, PHASE_SEAM, seam_begin, pixels);
+}
+
+// Every 2x2 block of edges becomes its mean in the proxy, the last row and
+// column are repeated for odd sizes. Pooling the full resolution energy keeps
+// fine texture expensive, which the sobel of a downscaled image would lose.
+static Mat carve_downscale(Mat edges) {
+  mat_alloc(Mat, proxy, (edges.height + 1) / 2, (edges.width + 1) / 2);
+  for (int y = 0; y < proxy.height; y++) {
+    int y0 = 2 * y, y1 = 2 * y + 1 < edges.height ? 2 * y + 1 : 2 * y;
+    for (int x = 0; x < proxy.width; x++) {
+      int x0 = 2 * x, x1 = 2 * x + 1 < edges.width ? 2 * x + 1 : 2 * x;
+      MAT_AT(proxy, y, x) = (MAT_AT(edges, y0, x0) + MAT_AT(edges, y0, x1) +
+                             MAT_AT(edges, y1, x0) + MAT_AT(edges, y1, x1)) /
+                            4;
+    }
+  }
+  return proxy;
+}
+
+// Number of entries of the sorted gone[0..count) below the column x.
+static int gone_before(const int *gone, int count, int x) {
+  int lo = 0, hi = count;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (gone[mid] < x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Original column of the current column col, given the sorted original
+// columns gone[0..count) already removed from the row. gone[i] - i never
+// decreases, so the ones left of it are found by bisection as well.
+static int gone_original(const int *gone, int count, int col) {
+  int lo = 0, hi = count;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (gone[mid] - mid <= col)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return col + lo;
+}
+
+// Carves half the seams on the pooled energy of a half size proxy (which may
+// in turn use a proxy of its own), then turns every seam found there into two
+// seams at this level. Those only need the dp inside a band around the scaled
+// up proxy seam, so each costs O(height * CARVE_PROXY_BAND) instead of the
+// whole plane. The proxy seams are followed in original columns, the sorted
+// list of original columns removed from every row turns them into current
+// ones, so seams wandering inside their band do not shift where the later
+// ones land. Those lists only grow by one column per seam.
+// Returns how many seams are left to carve at full cost.
+static int carve_level_proxy(Carve_Level *level, int factor, int rm_seams) {
+  Seam_Stream proxy_seams = {0};
+  Carve_Level proxy = {
+      .edges = carve_downscale(level->edges),
+      .k = level->k,
+      .stats = level->stats,
+      .seams = &proxy_seams,
+  };
+  int proxy_width = proxy.edges.width, proxy_height = proxy.edges.height;
+  mat_alloc(Mat, proxy_dp, proxy_height, proxy_width);
+  proxy.dp = proxy_dp;
+  proxy.seam = NOB_REALLOC(NULL, proxy_height * sizeof(*proxy.seam));
+  proxy.lo = NOB_REALLOC(NULL, proxy_height * sizeof(*proxy.lo));
+  proxy.hi = NOB_REALLOC(NULL, proxy_height * sizeof(*proxy.hi));
+  NOB_ASSERT(proxy.seam != NULL && proxy.lo != NULL && proxy.hi != NULL &&
+             "buy more ram lol");
+  seam_stream_begin(&proxy_seams, proxy_width, proxy_height);
+
+  int proxy_rm = rm_seams / 2;
+  if (factor > 2 && proxy_width >= 16 && proxy_height >= 16)
+    proxy_rm = carve_level_proxy(&proxy, factor / 2, proxy_rm);
+  while (proxy_rm--)
+    carve_level_full(&proxy);
+  NOB_FREE(proxy.edges.items);
+  NOB_FREE(proxy.dp.items);
+  NOB_FREE(proxy.seam);
+  NOB_FREE(proxy.lo);
+  NOB_FREE(proxy.hi);
+
+  // original proxy column of every proxy seam, one row after the other
+  int seams = proxy_seams.seams;
+  int *up = NOB_REALLOC(NULL, (size_t)(seams + 1) * proxy_height * sizeof(*up));
+  int *cols = NOB_REALLOC(NULL, (seams + 1) * sizeof(*cols));
+  int *tree = NOB_REALLOC(NULL, (proxy_width + 1) * sizeof(*tree));
+  NOB_ASSERT(up != NULL && cols != NULL && tree != NULL && "buy more ram lol");
+  for (int y = 0; y < proxy_height; y++)
+    seam_stream_row(&proxy_seams, y, cols, tree, up + (size_t)y * seams);
+  NOB_FREE(cols);
+  NOB_FREE(tree);
+  seam_stream_free(&proxy_seams);
+
+  int height = level->edges.height;
+  size_t stride = 2 * (size_t)seams;
+  int *gone = NOB_REALLOC(NULL, (stride * height + 1) * sizeof(*gone));
+  NOB_ASSERT(gone != NULL && "buy more ram lol");
+  int *lo = level->lo, *hi = level->hi;
+
+  Carve_Stats *stats = level->stats;
+  for (int i = 0; i < seams; i++) {
+    for (int pass = 0; pass < 2; pass++) {
+      int current = level->edges.width, count = 2 * i + pass;
+      int reach_lo = 0, reach_hi = current - 1;
+      for (int y = 0; y < height; y++) {
+        int orig = 2 * up[(size_t)y / 2 * seams + i];
+        int x = orig - gone_before(gone + y * stride, count, orig);
+        lo[y] = x - CARVE_PROXY_BAND < 0 ? 0 : x - CARVE_PROXY_BAND;
+        hi[y] = x + 1 + CARVE_PROXY_BAND >= current
+                    ? current - 1
+                    : x + 1 + CARVE_PROXY_BAND;
+        // the band has to stay reachable from the one above
+        if (y > 0) {
+          if (lo[y] > reach_hi + 1)
+            lo[y] = reach_hi + 1;
+          if (hi[y] < reach_lo - 1)
+            hi[y] = reach_lo - 1;
+          reach_lo = lo[y] > reach_lo - 1 ? lo[y] : reach_lo - 1;
+          reach_hi = hi[y] < reach_hi + 1 ? hi[y] : reach_hi + 1;
+        } else {
+          reach_lo = lo[y];
+          reach_hi = hi[y];
+        }
+      }
+
+      uint64_t band = (uint64_t)height * (2 * CARVE_PROXY_BAND + 2);
+      uint64_t pixels = (uint64_t)current * height;
+      uint64_t seam_begin = phase_begin(stats, PHASE_SEAM);
+
+      uint64_t begin = phase_begin(stats, PHASE_DP);
+      level->dp_current = false;
+      build_dp_band(level->edges, level->dp, lo, hi);
+      phase_end(stats, PHASE_DP, begin, band);
+
+      begin = phase_begin(stats, PHASE_BACKTRACK);
+      find_seam_band(level->dp, lo, hi, level->seam);
+      for (int y = 0; y < height; y++) {
+        int *row = gone + y * stride;
+        int x = gone_original(row, count, level->seam[y]);
+        int at = x - level->seam[y];
+        memmove(row + at + 1, row + at, (count - at) * sizeof(*row));
+        row[at] = x;
+      }
+      phase_end(stats, PHASE_BACKTRACK, begin, height);
+
+      carve_level_remove(level, pixels);
+      phase_end(stats, PHASE_SEAM, seam_begin, pixels);
+    }
+  }
+
+  NOB_FREE(up);
+  NOB_FREE(gone);
+  return rm_seams - 2 * seams;
+}
+
+static Mat carve_order_plane(float *planes, int index, int height, int width,
+                             int stride, size_t area) {
+  Mat mat = {
+      .height = height,
+      .width = width,
+      .stride = stride,
+      .items = planes + (size_t)index * area,
+  };
+  return mat;
+}
+
+// Fills the transport map of the paper: T(r, c) is the least energy of
+// removing r rows and c columns in any order, reached either from T(r-1, c)
+// by a horizontal seam or from T(r, c-1) by a vertical one. The images of
+// the previous and the current row of the table are kept, which is why the
+// energy is pooled down until the whole table fits CARVE_ORDER_BUDGET; every
+// step of the pooled order then stands for factor steps at full size.
+// Returns the order as a string of 'v' and 'h'.
+static char *carve_order_optimal(Mat edges, int rm_cols, int rm_rows,
+                                 const Kernels *k) {
+  Mat pooled = edges;
+  int factor = 1;
+  for (;;) {
+    uint64_t area = (uint64_t)pooled.width * pooled.height;
+    uint64_t cols = rm_cols / factor + 1, rows = rm_rows / factor + 1;
+    if ((cols * rows * area <= CARVE_ORDER_BUDGET &&
+         2 * cols * area <= CARVE_ORDER_BUDGET / 8) ||
+        pooled.width < 16 || pooled.height < 16)
+      break;
+    Mat next = carve_downscale(pooled);
+    if (factor > 1)
+      NOB_FREE(pooled.items);
+    pooled = next;
+    factor *= 2;
+  }
+  int cols = rm_cols / factor, rows = rm_rows / factor;
+  int width = pooled.width, height = pooled.height;
+  size_t area = (size_t)width * height, cells = (size_t)(cols + 1) * (rows + 1);
+
+  float *planes = NOB_REALLOC(NULL, 2 * (cols + 1) * area * sizeof(*planes));
+  float *dp_items = NOB_REALLOC(NULL, area * sizeof(*dp_items));
+  int *col_seam = NOB_REALLOC(NULL, height * sizeof(*col_seam));
+  int *row_seam = NOB_REALLOC(NULL, width * sizeof(*row_seam));
+  float *cost = NOB_REALLOC(NULL, cells * sizeof(*cost));
+  bool *from_above = NOB_REALLOC(NULL, cells * sizeof(*from_above));
+  NOB_ASSERT(planes != NULL && dp_items != NULL && col_seam != NULL &&
+             row_seam != NULL && cost != NULL && from_above != NULL &&
+             "buy more ram lol");
+
+  for (int r = 0; r <= rows; r++) {
+    for (int c = 0; c <= cols; c++) {
+      size_t cell = (size_t)r * (cols + 1) + c;
+      Mat dst = carve_order_plane(planes, (r % 2) * (cols + 1) + c,
+                                  height - r, width - c, width, area);
+      if (r == 0 && c == 0) {
+        for (int y = 0; y < height; y++)
+          memcpy(&MAT_AT(dst, y, 0), &MAT_AT(pooled, y, 0),
+                 width * sizeof(float));
+        cost[cell] = 0;
+        continue;
+      }
+
+      float above = FLT_MAX, left = FLT_MAX;
+      Mat up = {0}, prev = {0};
+      if (r > 0) {
+        up = carve_order_plane(planes, ((r - 1) % 2) * (cols + 1) + c,
+                               height - r + 1, width - c, width, area);
+        above = cost[cell - (cols + 1)] +
+                find_seam_horizontal(k, up, dp_items, row_seam);
+      }
+      if (c > 0) {
+        prev = carve_order_plane(planes, (r % 2) * (cols + 1) + c - 1,
+                                 height - r, width - c + 1, width, area);
+        Mat dp = {prev.height, prev.width, width, dp_items};
+        k->build_dp(prev, dp);
+        find_seam(dp, col_seam);
+        left = cost[cell - 1] + MAT_AT(dp, dp.height - 1,
+                                       col_seam[dp.height - 1]);
+      }
+
+      from_above[cell] = above < left;
+      cost[cell] = from_above[cell] ? above : left;
+      Mat src = from_above[cell] ? up : prev;
+      for (int y = 0; y < src.height; y++)
+        memcpy(&MAT_AT(dst, y, 0), &MAT_AT(src, y, 0),
+               src.width * sizeof(float));
+      if (from_above[cell]) {
+        dst.height++;
+        mat_remove_seam_horizontal(row_seam, dst);
+      } else {
+        dst.width++;
+        mat_remove_seam(col_seam, dst);
+      }
+    }
+  }
+
+  char *order = NOB_REALLOC(NULL, rm_cols + rm_rows + 1);
+  NOB_ASSERT(order != NULL && "buy more ram lol");
+  int r = rows, c = cols, n = (rows + cols) * factor;
+  while (r > 0 || c > 0) {
+    bool h = from_above[(size_t)r * (cols + 1) + c];
+    for (int i = 0; i < factor; i++)
+      order[--n] = h ? 'h' : 'v';
+    if (h)
+      r--;
+    else
+      c--;
+  }
+  // whatever the pooling rounded away comes last
+  n = (rows + cols) * factor;
+  for (int i = cols * factor; i < rm_cols; i++)
+    order[n++] = 'v';
+  for (int i = rows * factor; i < rm_rows; i++)
+    order[n++] = 'h';
+  order[n] = '\0';
+
+  if (factor > 1)
+    NOB_FREE(pooled.items);
+  NOB_FREE(planes);
+  NOB_FREE(dp_items);
+  NOB_FREE(col_seam);
+  NOB_FREE(row_seam);
+  NOB_FREE(cost);
+  NOB_FREE(from_above);
+  return order;
+}
+
+// Decodes the i-th seam of the stream into columns of the image with all
+// seams before it removed.
+static void seam_stream_seam(const Seam_Stream *stream, int i, int *seam) {
+  const uint8_t *src =
+      stream->items + (size_t)i * seam_stream_record_size(stream->height);
+  uint32_t start;
+  memcpy(&start, src, sizeof(start));
+  const uint8_t *steps = src + sizeof(start);
+  seam[0] = start;
+  for (int y = 1; y < stream->height; y++)
+    seam[y] = seam[y - 1] + ((steps[(y - 1) / 4] >> (2 * ((y - 1) % 4))) & 3) -
+              1;
+}
+
+// Follows the seams of the previous frame: every seam is searched within
+// band columns of the prior one at the same step, so consecutive frames lose
+// the same content and do not flicker. The first seam gets a full dp, which
+// gives the cost the bands are held against, anything much more expensive,
+// like after a scene cut, gets a full dp of its own. Returns how many seams
+// are left once the prior runs out.
+static int carve_level_prior(Carve_Level *level, const Seam_Stream *prior,
+                             int band, int rm_seams) {
+  NOB_ASSERT(prior->width == level->img.width &&
+             prior->height == level->img.height &&
+             "prior seams are of another size");
+  if (rm_seams == 0 || prior->seams == 0)
+    return rm_seams;
+  carve_level_full(level);
+  int seams = rm_seams < prior->seams ? rm_seams : prior->seams;
+  for (int i = 1; i < seams; i++) {
+    seam_stream_seam(prior, i, level->seam);
+    carve_level_banded(level, band);
+  }
+  return rm_seams - seams;
+}
+
+// Writes the mean of the pixels a and b, channel by channel, to dst.
+static void raster_average(Raster img, uint8_t *dst, const uint8_t *a,
+                           const uint8_t *b) {
+  for (int c = 0; c < img.channels; c++) {
+    switch (img.depth) {
+    case DEPTH_8:
+      dst[c] = (a[c] + b[c]) / 2;
+      break;
+    case DEPTH_16:
+      ((uint16_t *)dst)[c] =
+          (((const uint16_t *)a)[c] + ((const uint16_t *)b)[c]) / 2;
+      break;
+    case DEPTH_FLOAT:
+      ((float *)dst)[c] = (((const float *)a)[c] + ((const float *)b)[c]) / 2;
+      break;
+    default:
+      NOB_ASSERT(0 && "unreachable");
+    }
+  }
+}
+
+// Widens img back to width by inserting seams, each one the average of a
+// pixel and its right neighbour. The seams are the ones a carve of a copy
+// would remove first, recorded as a seam stream so seam_stream_row maps them
+// to columns of img directly. A carve removes at most two thirds of the
+// width, so wider gaps take a few rounds. The stride must leave room for it.
+static Raster carve_restore_width(Raster img, Mask mask, int width,
+                                  Carve_Opts opts) {
+  NOB_ASSERT(width <= img.stride && "no room to restore the width");
+  size_t size = raster_pixel_size(img);
+  while (img.width < width) {
+    Raster copy = img;
+    copy.stride = img.width;
+    copy.items = NOB_REALLOC(NULL, (size_t)img.height * img.width * size);
+    NOB_ASSERT(copy.items != NULL && "buy more ram lol");
+    for (int y = 0; y < img.height; y++)
+      memcpy(raster_row(copy, y), raster_row(img, y), img.width * size);
+    Mask copy_mask = {0};
+    if (mask.items != NULL) {
+      mat_alloc(Mask, m, mask.height, mask.width);
+      for (int y = 0; y < mask.height; y++)
+        memcpy(&MAT_AT(m, y, 0), &MAT_AT(mask, y, 0), mask.width);
+      copy_mask = m;
+    }
+
+    Seam_Stream stream = {0};
+    Carve_Arena arena = {0};
+    Carve_Opts sub = {
+        .target_width = img.width > width - img.width
+                            ? img.width - (width - img.width)
+                            : 1,
+        .energy = opts.energy,
+        .lum_model = opts.lum_model,
+        .dp = opts.dp,
+        .dp_budget = opts.dp_budget,
+        .kernels = opts.kernels,
+        .mask = copy_mask,
+        .seams = &stream,
+    };
+    carve_raster(copy, sub, &arena);
+    carve_arena_free(&arena);
+    NOB_FREE(copy.items);
+    NOB_FREE(copy_mask.items);
+    if (stream.seams == 0) {
+      seam_stream_free(&stream);
+      break;
+    }
+
+    int seams = stream.seams;
+    int *cols = NOB_REALLOC(NULL, seams * sizeof(*cols));
+    int *orig = NOB_REALLOC(NULL, seams * sizeof(*orig));
+    int *tree = NOB_REALLOC(NULL, (img.width + 1) * sizeof(*tree));
+    uint8_t *insert = calloc(img.width, 1);
+    NOB_ASSERT(cols != NULL && orig != NULL && tree != NULL &&
+               insert != NULL && "buy more ram lol");
+    for (int y = 0; y < img.height; y++) {
+      seam_stream_row(&stream, y, cols, tree, orig);
+      for (int i = 0; i < seams; i++)
+        insert[orig[i]] = 1;
+      // right to left, so every pixel is read before anything lands on it
+      uint8_t *row = raster_row(img, y);
+      uint8_t *mask_row = mask.items ? &MAT_AT(mask, y, 0) : NULL;
+      int dst = img.width + seams - 1;
+      for (int x = img.width - 1; x >= 0; x--) {
+        if (insert[x]) {
+          raster_average(img, row + dst * size, row + x * size,
+                         row + (x + 1 < img.width ? x + 1 : x) * size);
+          if (mask_row)
+            mask_row[dst] = mask_row[x];
+          dst--;
+          insert[x] = 0;
+        }
+        memcpy(row + dst * size, row + x * size, size);
+        if (mask_row)
+          mask_row[dst] = mask_row[x];
+        dst--;
+      }
+    }
+    img.width += seams;
+    mask.width += seams;
+
+    NOB_FREE(cols);
+    NOB_FREE(orig);
+    NOB_FREE(tree);
+    free(insert);
+    seam_stream_free(&stream);
+  }
+  return img;
+}
+
+Raster carve_raster(Raster img, Carve_Opts opts, Carve_Arena *arena) {
+  NOB_ASSERT(img.width > 0 && img.height > 0 &&
+             "enter valid matrix dimensions");
+  NOB_ASSERT(img.channels >= 1 && img.channels <= 4 &&
+             "pixels have 1 to 4 channels");
+  NOB_ASSERT(0 <= opts.energy && opts.energy < COUNT_ENERGIES &&
+             "unknown energy");
+  NOB_ASSERT((opts.energy != ENERGY_EXTERNAL ||
+              (opts.energy_map.items != NULL &&
+               MAT_SAME_DIM(img, opts.energy_map))) &&
+             "the energy map must be of the same size as the image");
+  NOB_ASSERT((opts.energy != ENERGY_EXTERNAL || !opts.restore_width) &&
+             "the energy map cannot be widened along with the image");
+  NOB_ASSERT(opts.proxy >= 0 && (opts.proxy & (opts.proxy - 1)) == 0 &&
+             "proxy factor must be a power of two");
+  NOB_ASSERT((opts.mask.items == NULL || MAT_SAME_DIM(img, opts.mask)) &&
+             "mask must be of the same size as the image");
+  NOB_ASSERT((!opts.object_removal || opts.mask.items != NULL) &&
+             "object removal needs a mask");
+  NOB_ASSERT((!opts.restore_width || opts.seams == NULL) &&
+             "seam streams cannot record inserted seams");
+
+  Img size = {.height = img.height, .width = img.width};
+  int rm_seams = carve_seams_for(size, opts);
+  int rm_rows = carve_rows_for(size, opts);
+  size_t plane = (size_t)img.width * img.height;
+  size_t budget = opts.dp_budget > 0 ? opts.dp_budget : CARVE_DP_BUDGET;
+  Dp_Mode dp_mode = opts.dp;
+  if (dp_mode == DP_PLANE && plane * sizeof(float) > budget)
+    dp_mode = DP_CHECKPOINT;
+  // everything but full vertical searches needs the float plane
+  if (rm_rows > 0 || opts.band > 0 || opts.proxy > 1 || opts.prior != NULL)
+    dp_mode = DP_PLANE;
+
+  // the steps are bytes, rounded up to whole floats of the arena
+  size_t dirs = ((size_t)img.height * dirs_stride(img.width) + 3) / 4;
+  int rows = 1;
+  while (rows * rows < img.height)
+    rows++;
+  size_t checkpoints = 2 * (size_t)rows * img.width;
+  size_t dp_size = dp_mode == DP_ROLLING      ? dirs
+                   : dp_mode == DP_CHECKPOINT ? checkpoints
+                                              : plane;
+  // the luminance plane goes last, the color energies never reserve it
+  size_t lum_size = energy_reads_lum(opts.energy) ? plane : 0;
+  carve_arena_reserve(arena, plane + dp_size + lum_size);
+  Carve_Level level = {
+      .img = img,
+      .lum = {.height = img.height, .width = img.width},
+      .edges = carve_arena_mat(arena, 0, img.height, img.width),
+      .mask = opts.mask,
+      .k = opts.kernels ? opts.kernels : kernels_select(NULL),
+      .update_horizontal = energy_updates_horizontal[opts.energy],
+      .stats = opts.stats,
+      .seams = opts.seams,
+  };
+  if (dp_mode == DP_ROLLING) {
+    level.dirs = (uint8_t *)(arena->items + plane);
+    level.dp = (Mat){.height = img.height, .width = img.width};
+  } else if (dp_mode == DP_CHECKPOINT) {
+    level.dp = (Mat){
+        .height = rows,
+        .width = img.width,
+        .stride = img.width,
+        .items = arena->items + plane,
+    };
+    level.checkpoints = level.dp.items + (size_t)rows * img.width;
+  } else {
+    level.dp = carve_arena_mat(arena, 1, img.height, img.width);
+  }
+  if (lum_size > 0) {
+    level.lum.stride = img.width;
+    level.lum.items = arena->items + plane + dp_size;
+  }
+  level.energy = level.k->energies[opts.energy];
+  Carve_Stats *stats = opts.stats;
+  level.seam = NOB_REALLOC(NULL, img.height * sizeof(*level.seam));
+  level.row_seam = NOB_REALLOC(NULL, img.width * sizeof(*level.row_seam));
+  level.lo = NOB_REALLOC(NULL, img.height * sizeof(*level.lo));
+  level.hi = NOB_REALLOC(NULL, img.height * sizeof(*level.hi));
+  level.dirty_lo = NOB_REALLOC(NULL, img.height * sizeof(*level.dirty_lo));
+  level.dirty_hi = NOB_REALLOC(NULL, img.height * sizeof(*level.dirty_hi));
+  level.zeros = calloc(img.width, sizeof(*level.zeros));
+  level.scratch = NOB_REALLOC(NULL, 3 * img.width * sizeof(*level.scratch));
+  NOB_ASSERT(level.seam != NULL && level.row_seam != NULL &&
+             level.lo != NULL && level.hi != NULL && level.dirty_lo != NULL &&
+             level.dirty_hi != NULL && level.zeros != NULL &&
+             level.scratch != NULL && "buy more ram lol");
+
+  uint64_t pixels = (uint64_t)img.width * img.height;
+  uint64_t begin;
+  if (level.lum.items != NULL) {
+    begin = phase_begin(stats, PHASE_LUMINANCE);
+    if (opts.energy == ENERGY_EXTERNAL) {
+      for (int y = 0; y < img.height; y++)
+        memcpy(&MAT_AT(level.lum, y, 0), &MAT_AT(opts.energy_map, y, 0),
+               img.width * sizeof(float));
+    } else {
+      level.k->rgb_to_lum(img, opts.lum_model, level.lum);
+    }
+    phase_end(stats, PHASE_LUMINANCE, begin, pixels);
+  }
+
+  begin = phase_begin(stats, PHASE_SOBEL);
+  level.energy.filter(img, level.lum, level.mask, level.edges, level.zeros);
+  phase_end(stats, PHASE_SOBEL, begin, pixels);
+
+  NOB_ASSERT((opts.seams == NULL || rm_rows == 0) &&
+             "seam streams only record vertical seams");
+  if (opts.seams != NULL)
+    seam_stream_begin(opts.seams, img.width, img.height);
+
+  if (opts.object_removal) {
+    for (int y = 0; y < img.height; y++) {
+      for (int x = 0; x < img.width; x++)
+        level.marked += MAT_AT(opts.mask, y, x) == MASK_REMOVE;
+    }
+    while (level.marked > 0 && level.img.width > 1) {
+      int before = level.marked;
+      carve_level_full(&level);
+      // whatever is left is walled in by protected pixels
+      if (level.marked == before)
+        break;
+    }
+  } else if (opts.order == ORDER_GREEDY) {
+    while (rm_seams > 0 || rm_rows > 0)
+      carve_level_greedy(&level, &rm_seams, &rm_rows);
+  } else if (opts.order == ORDER_OPTIMAL && rm_seams > 0 && rm_rows > 0) {
+    char *order = carve_order_optimal(level.edges, rm_seams, rm_rows, level.k);
+    for (char *step = order; *step; step++) {
+      if (*step == 'v')
+        carve_level_full(&level);
+      else
+        carve_level_full_horizontal(&level);
+    }
+    NOB_FREE(order);
+  } else {
+    if (opts.prior != NULL)
+      rm_seams = carve_level_prior(
+          &level, opts.prior, opts.band > 0 ? opts.band : CARVE_PRIOR_BAND,
+          rm_seams);
+    // a proxy of only a few pixels has nothing left worth carving
+    else if (opts.proxy > 1 && img.width >= 16 && img.height >= 16)
+      rm_seams = carve_level_proxy(&level, opts.proxy, rm_seams);
+    // the band follows the last seam, so the first one always needs a full
+    // dp
+    bool first = true;
+    while (rm_seams--) {
+      if (opts.band > 0 && !first)
+        carve_level_banded(&level, opts.band);
+      else
+        carve_level_full(&level);
+      first = false;
+    }
+    while (rm_rows--)
+      carve_level_full_horizontal(&level);
+  }
+
+  NOB_FREE(level.seam);
+  NOB_FREE(level.row_seam);
+  NOB_FREE(level.lo);
+  NOB_FREE(level.hi);
+  NOB_FREE(level.dirty_lo);
+  NOB_FREE(level.dirty_hi);
+  NOB_FREE(level.zeros);
+  NOB_FREE(level.scratch);
+  if (opts.object_removal && opts.restore_width)
+    return carve_restore_width(level.img, level.mask, img.width, opts);
+  return level.img;
+}
+
+Img carve(Img img, Carve_Opts opts, Carve_Arena *arena) {
+  Raster carved = carve_raster(img_raster(img), opts, arena);
+  img.width = carved.width;
+  img.height = carved.height;
+  return img;
+}
+
+// Min cut of a (time x height x band) grid graph, the graph of "Improved
+// seam carving for video retargeting" restricted to a band of columns around
+// a guide seam. Node i of a row stands for column lo[y] + i. Cutting the arc
+// from node i to i + 1 costs the energy of column lo[y] + i and makes it the
+// seam pixel of the row; infinite arcs back from i + 1 to i and diagonally
+// to column i - 1 of the rows above and below and of the frames before and
+// after keep every cut one connected seam per frame that moves by at most a
+// column between neighbouring rows and frames. Node 0 of every row is tied
+// to the source and the arc out of the last node goes to the sink.
+//
+// The graph is implicit: a node only stores its excess, its label, the net
+// flow on the arc to its right and the flow on its four diagonal arcs.
+// Infinite arcs never saturate, so the flow on them is only needed to know
+// how much can be sent back. The cut comes from FIFO push-relabel with
+// periodic global relabeling.
+typedef struct {
+  int frames;
+  int height;
+  int band;
+  const int *lo;
+  // capacity of the arc to the right of every node
+  float *cap;
+  float *excess;
+  int *label;
+  float *right;
+  float *diag;
+  int *queue;
+  uint8_t *queued;
+} Cut_Volume;
+
+typedef enum {
+  CUT_UP,
+  CUT_DOWN,
+  CUT_PREV,
+  CUT_NEXT,
+  COUNT_CUT_DIAGS,
+} Cut_Diag;
+
+// Node u sits at column lo[y] + i of row y of frame t.
+typedef struct {
+  int i;
+  int y;
+  int t;
+} Cut_Pos;
+
+static Cut_Pos cut_pos(const Cut_Volume *v, int u) {
+  int row = u / v->band;
+  return (Cut_Pos){u - row * v->band, row % v->height, row / v->height};
+}
+
+// Node the diagonal arc d of the node at p leads to, -1 when it leads out of
+// the volume or into the source.
+static int cut_out(const Cut_Volume *v, Cut_Pos p, Cut_Diag d) {
+  int i = p.i, y = p.y, t = p.t;
+  int yy = y, tt = t;
+  switch (d) {
+  case CUT_UP: yy--; break;
+  case CUT_DOWN: yy++; break;
+  case CUT_PREV: tt--; break;
+  case CUT_NEXT: tt++; break;
+  default: NOB_ASSERT(0 && "unreachable");
+  }
+  if (yy < 0 || yy >= v->height || tt < 0 || tt >= v->frames)
+    return -1;
+  int ii = i - 1 + v->lo[y] - v->lo[yy];
+  if (ii < 1)
+    return -1;
+  return (tt * v->height + yy) * v->band + ii;
+}
+
+// Node whose diagonal arc d leads to the node at p, -1 when there is none in
+// the volume.
+static int cut_in(const Cut_Volume *v, Cut_Pos p, Cut_Diag d) {
+  int i = p.i, y = p.y, t = p.t;
+  int yy = y, tt = t;
+  switch (d) {
+  case CUT_UP: yy++; break;
+  case CUT_DOWN: yy--; break;
+  case CUT_PREV: tt++; break;
+  case CUT_NEXT: tt--; break;
+  default: NOB_ASSERT(0 && "unreachable");
+  }
+  if (yy < 0 || yy >= v->height || tt < 0 || tt >= v->frames)
+    return -1;
+  int ii = i + 1 + v->lo[y] - v->lo[yy];
+  if (ii < 1 || ii >= v->band)
+    return -1;
+  return (tt * v->height + yy) * v->band + ii;
+}
+
+// Labels every node with its distance to the sink in the residual graph, the
+// ones that cannot reach it get the node count and are on the source side of
+// the cut.
+static void cut_global_relabel(Cut_Volume *v) {
+  int nodes = v->frames * v->height * v->band;
+  for (int u = 0; u < nodes; u++)
+    v->label[u] = nodes;
+  int head = 0, tail = 0;
+  for (int r = 0; r < v->frames * v->height; r++) {
+    int u = r * v->band + v->band - 1;
+    if (v->band > 1 && v->right[u] < v->cap[u]) {
+      v->label[u] = 1;
+      v->queue[tail++] = u;
+    }
+  }
+  while (head < tail) {
+    int w = v->queue[head++];
+    Cut_Pos p = cut_pos(v, w);
+    int from[2 + 2 * COUNT_CUT_DIAGS], count = 0;
+    if (p.i - 1 >= 1 && v->right[w - 1] < v->cap[w - 1])
+      from[count++] = w - 1;
+    if (p.i + 1 < v->band)
+      from[count++] = w + 1;
+    for (int d = 0; d < COUNT_CUT_DIAGS; d++) {
+      int u = cut_in(v, p, d);
+      if (u >= 0)
+        from[count++] = u;
+      u = cut_out(v, p, d);
+      if (u >= 0 && v->diag[w * COUNT_CUT_DIAGS + d] > 0)
+        from[count++] = u;
+    }
+    for (int j = 0; j < count; j++) {
+      if (v->label[from[j]] == nodes) {
+        v->label[from[j]] = v->label[w] + 1;
+        v->queue[tail++] = from[j];
+      }
+    }
+  }
+}
+
+// Pushes the excess of u along admissible arcs until it is gone or u needs a
+// new label. Returns whether it got relabeled.
+static bool cut_discharge(Cut_Volume *v, int u, int *tail) {
+  int nodes = v->frames * v->height * v->band;
+  Cut_Pos p = cut_pos(v, u);
+  int i = p.i;
+  int lowest = nodes;
+  // the queue holds every node at most once, so it never wraps onto itself
+#define CUT_ACTIVATE(w)                                                        \
+  do {                                                                         \
+    if (!v->queued[w] && v->label[w] < nodes) {                                \
+      v->queued[w] = 1;                                                        \
+      v->queue[*tail] = (w);                                                   \
+      *tail = (*tail + 1) % nodes;                                             \
+    }                                                                          \
+  } while (0)
+
+  float residual = v->cap[u] - v->right[u];
+  if (residual > 0) {
+    int label = i + 1 < v->band ? v->label[u + 1] : 0;
+    if (v->label[u] == label + 1) {
+      float delta = v->excess[u] < residual ? v->excess[u] : residual;
+      if (delta == residual)
+        v->right[u] = v->cap[u];
+      else
+        v->right[u] += delta;
+      v->excess[u] -= delta;
+      if (i + 1 < v->band) {
+        v->excess[u + 1] += delta;
+        CUT_ACTIVATE(u + 1);
+      }
+      if (v->excess[u] <= 0)
+        return v->excess[u] = 0, false;
+    } else if (label < lowest) {
+      lowest = label;
+    }
+  }
+  if (i - 1 >= 1) {
+    if (v->label[u] == v->label[u - 1] + 1) {
+      v->right[u - 1] -= v->excess[u];
+      v->excess[u - 1] += v->excess[u];
+      v->excess[u] = 0;
+      CUT_ACTIVATE(u - 1);
+      return false;
+    } else if (v->label[u - 1] < lowest) {
+      lowest = v->label[u - 1];
+    }
+  }
+  for (int d = 0; d < COUNT_CUT_DIAGS; d++) {
+    int w = cut_out(v, p, d);
+    if (w < 0)
+      continue;
+    if (v->label[u] == v->label[w] + 1) {
+      v->diag[u * COUNT_CUT_DIAGS + d] += v->excess[u];
+      v->excess[w] += v->excess[u];
+      v->excess[u] = 0;
+      CUT_ACTIVATE(w);
+      return false;
+    } else if (v->label[w] < lowest) {
+      lowest = v->label[w];
+    }
+  }
+  for (int d = 0; d < COUNT_CUT_DIAGS; d++) {
+    int w = cut_in(v, p, d);
+    if (w < 0)
+      continue;
+    float *flow = &v->diag[w * COUNT_CUT_DIAGS + d];
+    if (*flow <= 0)
+      continue;
+    if (v->label[u] == v->label[w] + 1) {
+      float delta = v->excess[u] < *flow ? v->excess[u] : *flow;
+      *flow = delta == *flow ? 0 : *flow - delta;
+      v->excess[u] -= delta;
+      v->excess[w] += delta;
+      CUT_ACTIVATE(w);
+      if (v->excess[u] <= 0)
+        return v->excess[u] = 0, false;
+    } else if (v->label[w] < lowest) {
+      lowest = v->label[w];
+    }
+  }
+#undef CUT_ACTIVATE
+  v->label[u] = lowest + 1 < nodes ? lowest + 1 : nodes;
+  return true;
+}
+
+// Room for a volume of bands up to band nodes wide, the capacities are left
+// for the caller to fill.
+static Cut_Volume cut_volume_alloc(int frames, int height, int band,
+                                   const int *lo) {
+  size_t nodes = (size_t)frames * height * band;
+  Cut_Volume v = {
+      .frames = frames,
+      .height = height,
+      .band = band,
+      .lo = lo,
+      .cap = NOB_REALLOC(NULL, nodes * sizeof(float)),
+      .excess = NOB_REALLOC(NULL, nodes * sizeof(float)),
+      .label = NOB_REALLOC(NULL, nodes * sizeof(int)),
+      .right = NOB_REALLOC(NULL, nodes * sizeof(float)),
+      .diag = NOB_REALLOC(NULL, nodes * COUNT_CUT_DIAGS * sizeof(float)),
+      .queue = NOB_REALLOC(NULL, nodes * sizeof(int)),
+      .queued = NOB_REALLOC(NULL, nodes),
+  };
+  NOB_ASSERT(v.cap != NULL && v.excess != NULL && v.label != NULL &&
+             v.right != NULL && v.diag != NULL && v.queue != NULL &&
+             v.queued != NULL && "buy more ram lol");
+  return v;
+}
+
+static void cut_volume_free(Cut_Volume *v) {
+  NOB_FREE(v->cap);
+  NOB_FREE(v->excess);
+  NOB_FREE(v->label);
+  NOB_FREE(v->right);
+  NOB_FREE(v->diag);
+  NOB_FREE(v->queue);
+  NOB_FREE(v->queued);
+}
+
+// Finds the cheapest seam surface in the band and writes the seam of frame t
+// to seams[t * height ...]. Only the first phase of push-relabel runs: once
+// no node below the source's label has excess left, the nodes that can still
+// reach the sink are exactly the sink side of a minimum cut.
+static void cut_volume_solve(Cut_Volume *v, int *seams) {
+  int rows = v->frames * v->height;
+  int nodes = rows * v->band;
+  memset(v->right, 0, nodes * sizeof(*v->right));
+  memset(v->diag, 0, nodes * COUNT_CUT_DIAGS * sizeof(*v->diag));
+  memset(v->excess, 0, nodes * sizeof(*v->excess));
+  memset(v->queued, 0, nodes);
+  if (v->band > 1) {
+    // the arcs out of node 0 leave the source, they start saturated
+    for (int r = 0; r < rows; r++) {
+      int u = r * v->band;
+      v->right[u] = v->cap[u];
+      v->excess[u + 1] = v->right[u];
+    }
+
+    int relabels = 0;
+    bool relabel = true;
+    while (relabel) {
+      cut_global_relabel(v);
+      relabel = false;
+      // the bfs above used the queue, it starts over with the active nodes
+      int head = 0, tail = 0;
+      for (int u = 0; u < nodes; u++) {
+        v->queued[u] = 0;
+        if (v->excess[u] > 0 && v->label[u] < nodes) {
+          v->queued[u] = 1;
+          v->queue[tail] = u;
+          tail = (tail + 1) % nodes;
+        }
+      }
+      int active = tail;
+      if (active == 0)
+        break;
+      // a tail that wrapped to the head means a full queue
+      bool full = active == nodes;
+      while (full || head != tail) {
+        full = false;
+        int u = v->queue[head];
+        head = (head + 1) % nodes;
+        v->queued[u] = 0;
+        while (v->excess[u] > 0 && v->label[u] < nodes) {
+          if (!cut_discharge(v, u, &tail))
+            continue;
+          // stale labels make pushes wander, refresh them every so often
+          if (++relabels >= nodes) {
+            relabels = 0;
+            relabel = true;
+            break;
+          }
+        }
+        if (relabel)
+          break;
+      }
+    }
+    cut_global_relabel(v);
+  }
+
+  for (int r = 0; r < rows; r++) {
+    int y = r % v->height, source_side = 1;
+    for (int i = 1; i < v->band; i++)
+      source_side += v->label[r * v->band + i] == nodes;
+    seams[r] = v->lo[y] + source_side - 1;
+  }
+}
+
+void carve_volume(Img *frames, int count, Carve_Opts opts) {
+  NOB_ASSERT(count > 0 && "no frames to carve");
+  Img first = frames[0];
+  for (int t = 1; t < count; t++)
+    NOB_ASSERT(MAT_SAME_DIM(first, frames[t]) &&
+               "frames must be of the same size");
+  NOB_ASSERT(opts.energy < COUNT_ENERGIES && opts.energy != ENERGY_EXTERNAL &&
+             "every frame needs an energy computed from its pixels");
+  const Kernels *k = opts.kernels ? opts.kernels : kernels_select(NULL);
+  Energy_Kernels energy = k->energies[opts.energy];
+  int width = first.width, height = first.height;
+  int band = 2 * (opts.band > 0 ? opts.band : CARVE_VOLUME_BAND) + 1;
+  band = band < width ? band : width;
+
+  Mat *lum = NOB_REALLOC(NULL, count * sizeof(*lum));
+  Mat *edges = NOB_REALLOC(NULL, count * sizeof(*edges));
+  float *zeros = calloc(width, sizeof(*zeros));
+  NOB_ASSERT(lum != NULL && edges != NULL && zeros != NULL &&
+             "buy more ram lol");
+  for (int t = 0; t < count; t++) {
+    mat_alloc(Mat, e, height, width);
+    // the color energies are taken straight from the pixels, without lum
+    lum[t] = (Mat){.height = height, .width = width};
+    if (energy_reads_lum(opts.energy)) {
+      mat_alloc(Mat, l, height, width);
+      k->rgb_to_lum(img_raster(frames[t]), opts.lum_model, l);
+      lum[t] = l;
+    }
+    energy.filter(img_raster(frames[t]), lum[t], (Mask){0}, e, zeros);
+    edges[t] = e;
+  }
+  mat_alloc(Mat, dp, height, width);
+  int *guide = NOB_REALLOC(NULL, height * sizeof(*guide));
+  int *lo = NOB_REALLOC(NULL, height * sizeof(*lo));
+  int *seams = NOB_REALLOC(NULL, (size_t)count * height * sizeof(*seams));
+  NOB_ASSERT(guide != NULL && lo != NULL && seams != NULL &&
+             "buy more ram lol");
+  Cut_Volume v = cut_volume_alloc(count, height, band, lo);
+
+  int rm_seams = carve_seams_for(first, opts);
+  for (int s = 0; s < rm_seams; s++) {
+    // the band follows the cheapest seam of the energy summed over time
+    for (int y = 0; y < height; y++) {
+      float *sum = &MAT_AT(dp, y, 0);
+      memcpy(sum, &MAT_AT(edges[0], y, 0), width * sizeof(float));
+      for (int t = 1; t < count; t++) {
+        const float *e = &MAT_AT(edges[t], y, 0);
+        for (int x = 0; x < width; x++)
+          sum[x] += e[x];
+      }
+    }
+    k->build_dp(dp, dp);
+    find_seam(dp, guide);
+    for (int y = 0; y < height; y++) {
+      int x = guide[y] - band / 2;
+      x = x + band > width ? width - band : x;
+      lo[y] = x < 0 ? 0 : x;
+    }
+
+    v.band = band;
+    for (int t = 0; t < count; t++) {
+      for (int y = 0; y < height; y++) {
+        float *cap = v.cap + ((size_t)t * height + y) * band;
+        const float *e = &MAT_AT(edges[t], y, lo[y]);
+        // removal masks have negative energy, a cut cannot cost less than
+        // nothing
+        for (int i = 0; i < band; i++)
+          cap[i] = e[i] > 0 ? e[i] : 0;
+      }
+    }
+    cut_volume_solve(&v, seams);
+    for (int t = 0; t < count; t++) {
+      const int *seam = seams + (size_t)t * height;
+      k->remove_seam(seam, img_raster(frames[t]), lum[t], edges[t],
+                     (Mask){0});
+      frames[t].width--;
+      lum[t].width--;
+      edges[t].width--;
+      energy.update(seam, img_raster(frames[t]), lum[t], edges[t], (Mask){0},
+                    NULL, NULL, zeros);
+    }
+    width--;
+    dp.width--;
+    band = band < width ? band : width;
+  }
+
+  for (int t = 0; t < count; t++) {
+    NOB_FREE(lum[t].items);
+    NOB_FREE(edges[t].items);
+  }
+  NOB_FREE(lum);
+  NOB_FREE(edges);
+  NOB_FREE(zeros);
+  NOB_FREE(dp.items);
+  NOB_FREE(guide);
+  NOB_FREE(lo);
+  NOB_FREE(seams);
+  cut_volume_free(&v);
+}
+
+#endif // CARVE_IMPLEMENTATION
@@ -0,0 +1,651 @@
+/**
+ * @file kernels.c
+ * @brief Hot loops of the carver, compiled once per instruction set.
+ *
+ * nob.c builds this file several times with a different -march and
+ * KERNELS_ISA each time, and carve.h picks one of the resulting tables at
+ * runtime. The loops are plain C written so the compiler can vectorize the
+ * interior; they do the same float operations in the same order as the
+ * reference in carve.h, so every variant produces bit identical results
+ * (as long as -ffp-contract=off keeps multiply-adds from being fused).
+ */
+
+#include "carve.h"
+
+#ifndef KERNELS_ISA
+#error "KERNELS_ISA must be defined, see nob.c"
+#endif
+
+#define KERNELS_CONCAT2(a, b) a##_##b
+#define KERNELS_CONCAT(a, b) KERNELS_CONCAT2(a, b)
+#define KERNELS_STR2(a) #a
+#define KERNELS_STR(a) KERNELS_STR2(a)
+
+static bool kernels_supported(void) {
+  __builtin_cpu_init();
+#if defined(__AVX512F__)
+  return __builtin_cpu_supports("x86-64-v4");
+#elif defined(__AVX2__)
+  return __builtin_cpu_supports("x86-64-v3");
+#else
+  return __builtin_cpu_supports("sse2");
+#endif
+}
+
+// One loop per depth and channel count, so each of them vectorizes on its
+// own, reading the interleaved channels straight from the pixels. Gray
+// pixels read the same channel three times, like the reference.
+#define KERNELS_LUM_ROW(type, n, scale)                                        \
+  do {                                                                         \
+    const type *src = (const type *)raster_row(img, y);                        \
+    int g = n < 3 ? 0 : 1, b = n < 3 ? 0 : 2;                                  \
+    if (!linear) {                                                             \
+      for (int x = 0; x < img.width; x++) {                                    \
+        dst[x] = (w[0] * src[n * x] + w[1] * src[n * x + g] +                  \
+                  w[2] * src[n * x + b]) /                                     \
+                 scale;                                                        \
+      }                                                                        \
+    } else if (decode) {                                                       \
+      for (int x = 0; x < img.width; x++) {                                    \
+        dst[x] = wf[0] * decode[(int)src[n * x]] +                             \
+                 wf[1] * decode[(int)src[n * x + g]] +                         \
+                 wf[2] * decode[(int)src[n * x + b]];                          \
+      }                                                                        \
+    } else {                                                                   \
+      for (int x = 0; x < img.width; x++) {                                    \
+        dst[x] = wf[0] * (float)src[n * x] + wf[1] * (float)src[n * x + g] +   \
+                 wf[2] * (float)src[n * x + b];                                \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+#define KERNELS_LUM_ROWS(type, scale)                                          \
+  do {                                                                         \
+    switch (img.channels) {                                                    \
+    case 1:                                                                    \
+      KERNELS_LUM_ROW(type, 1, scale);                                         \
+      break;                                                                   \
+    case 2:                                                                    \
+      KERNELS_LUM_ROW(type, 2, scale);                                         \
+      break;                                                                   \
+    case 3:                                                                    \
+      KERNELS_LUM_ROW(type, 3, scale);                                         \
+      break;                                                                   \
+    default:                                                                   \
+      KERNELS_LUM_ROW(type, 4, scale);                                         \
+      break;                                                                   \
+    }                                                                          \
+  } while (0)
+
+// Linear light goes through the sRGB decode table, L* is taken on the row
+// of luminance right after, while it is still in the cache.
+static void kernels_rgb_to_lum(Raster img, Lum_Model model, Mat lum) {
+  NOB_ASSERT(MAT_SAME_DIM(img, lum) &&
+             "target and source must be of same size");
+  double w[3];
+  lum_weights(model, w);
+  float wf[3] = {w[0], w[1], w[2]};
+  bool linear = model == LUM_LINEAR || model == LUM_LAB;
+  const float *decode = linear && img.depth != DEPTH_FLOAT
+                            ? srgb_decode_table(img.depth)
+                            : NULL;
+  for (int y = 0; y < img.height; y++) {
+    float *dst = &MAT_AT(lum, y, 0);
+    if (img.depth == DEPTH_8)
+      KERNELS_LUM_ROWS(uint8_t, 255.0);
+    else if (img.depth == DEPTH_16)
+      KERNELS_LUM_ROWS(uint16_t, 65535.0);
+    else
+      KERNELS_LUM_ROWS(float, 1.0);
+    if (model == LUM_LAB) {
+      for (int x = 0; x < img.width; x++)
+        dst[x] = lab_lightness(dst[x]);
+    }
+  }
+}
+
+// The operators of the energies of the luminance, on three rows of it around
+// column x. They take the same taps in the same order as the reference.
+static inline float kernels_sobel_op(const float *up, const float *mid,
+                                     const float *down, int x) {
+  float vx = up[x - 1] - up[x + 1] + 2 * mid[x - 1] - 2 * mid[x + 1] +
+             down[x - 1] - down[x + 1];
+  float vy = up[x - 1] + 2 * up[x] + up[x + 1] - down[x - 1] -
+             2 * down[x] - down[x + 1];
+  return sqrtf(vx * vx + vy * vy);
+}
+
+static inline float kernels_scharr_op(const float *up, const float *mid,
+                                      const float *down, int x) {
+  float vx = 3 * up[x - 1] - 3 * up[x + 1] + 10 * mid[x - 1] -
+             10 * mid[x + 1] + 3 * down[x - 1] - 3 * down[x + 1];
+  float vy = 3 * up[x - 1] + 10 * up[x] + 3 * up[x + 1] - 3 * down[x - 1] -
+             10 * down[x] - 3 * down[x + 1];
+  return sqrtf(vx * vx + vy * vy);
+}
+
+static inline float kernels_l1_op(const float *up, const float *mid,
+                                  const float *down, int x) {
+  return fabsf(mid[x + 1] - mid[x - 1]) + fabsf(down[x] - up[x]);
+}
+
+static inline float kernels_external_op(const float *up, const float *mid,
+                                        const float *down, int x) {
+  (void)up;
+  (void)down;
+  return mid[x];
+}
+
+// The full pass and the refresh around a seam of one energy of the
+// luminance, generated from its operator so that every energy gets loops of
+// its own with the operator inlined, and is picked once per carve through
+// Kernels.energies instead of once per pixel.
+//
+// Border pixels treat everything outside the image as zero, which gives the
+// same sums as the reference skipping those taps. The mask is applied while
+// the energy is still in registers, the NULL check is loop invariant so the
+// compiler unswitches it out of the vector loop.
+//
+// The seam of every row is known up front, so the refresh is one pass over
+// the rows after the compaction. Away from the borders the four columns
+// around the seam need no bounds checks and go through the same straight
+// line code as the interior of the row, only the first and last row and the
+// outermost columns take the padded path.
+#define KERNELS_LUM_ENERGY(name)                                               \
+  static float kernels_##name##_at(const float *up, const float *mid,          \
+                                   const float *down, int x, int width) {      \
+    float a[3][3];                                                             \
+    const float *rows[3] = {up, mid, down};                                    \
+    for (int i = 0; i < 3; i++) {                                              \
+      for (int j = 0; j < 3; j++) {                                            \
+        int c = x + j - 1;                                                     \
+        a[i][j] = (c >= 0 && c < width) ? rows[i][c] : 0.0f;                   \
+      }                                                                        \
+    }                                                                          \
+    return kernels_##name##_op(a[0], a[1], a[2], 1);                           \
+  }                                                                            \
+                                                                               \
+  static void kernels_##name##_row(const float *up, const float *mid,          \
+                                   const float *down, const uint8_t *mask,     \
+                                   float *dst, int width) {                    \
+    dst[0] = kernels_##name##_at(up, mid, down, 0, width);                     \
+    if (mask)                                                                  \
+      dst[0] = mask_energy(dst[0], mask[0]);                                   \
+    for (int x = 1; x < width - 1; x++) {                                      \
+      float energy = kernels_##name##_op(up, mid, down, x);                    \
+      dst[x] = mask ? mask_energy(energy, mask[x]) : energy;                   \
+    }                                                                          \
+    if (width > 1) {                                                           \
+      dst[width - 1] = kernels_##name##_at(up, mid, down, width - 1, width);   \
+      if (mask)                                                                \
+        dst[width - 1] = mask_energy(dst[width - 1], mask[width - 1]);         \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void kernels_##name##_filter(Raster img, Mat lum, Mask mask,          \
+                                      Mat grad, const float *zeros) {          \
+    (void)img;                                                                 \
+    NOB_ASSERT(MAT_SAME_DIM(lum, grad) &&                                      \
+               "target and source must be of same size");                      \
+    for (int y = 0; y < lum.height; y++) {                                     \
+      const float *up = y > 0 ? &MAT_AT(lum, y - 1, 0) : zeros;                \
+      const float *down = y + 1 < lum.height ? &MAT_AT(lum, y + 1, 0) : zeros; \
+      const uint8_t *m = mask.items ? &MAT_AT(mask, y, 0) : NULL;              \
+      kernels_##name##_row(up, &MAT_AT(lum, y, 0), down, m,                    \
+                           &MAT_AT(grad, y, 0), lum.width);                    \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void kernels_##name##_update(const int *seam, Raster img, Mat lum,    \
+                                      Mat edges, Mask mask, int *lo, int *hi,  \
+                                      const float *zeros) {                    \
+    (void)img;                                                                 \
+    int width = lum.width, height = lum.height;                                \
+    for (int y = 0; y < height; y++) {                                         \
+      int a = seam[y] - 2 < 0 ? 0 : seam[y] - 2;                               \
+      int b = seam[y] + 1 >= width ? width - 1 : seam[y] + 1;                  \
+      if (lo != NULL) {                                                        \
+        lo[y] = a;                                                             \
+        hi[y] = b;                                                             \
+      }                                                                        \
+      const float *up = y > 0 ? &MAT_AT(lum, y - 1, 0) : zeros;                \
+      const float *mid = &MAT_AT(lum, y, 0);                                   \
+      const float *down = y + 1 < height ? &MAT_AT(lum, y + 1, 0) : zeros;     \
+      const uint8_t *m = mask.items ? &MAT_AT(mask, y, 0) : NULL;              \
+      float *dst = &MAT_AT(edges, y, 0);                                       \
+      if (a > 0 && b < width - 1) {                                            \
+        /* a fixed count of 4 lets this become one vector op */                \
+        for (int i = 0; i < 4; i++)                                            \
+          dst[a + i] = kernels_##name##_op(up, mid, down, a + i);              \
+      } else {                                                                 \
+        for (int x = a; x <= b; x++)                                           \
+          dst[x] = kernels_##name##_at(up, mid, down, x, width);               \
+      }                                                                        \
+      if (m) {                                                                 \
+        for (int x = a; x <= b; x++)                                           \
+          dst[x] = mask_energy(dst[x], m[x]);                                  \
+      }                                                                        \
+    }                                                                          \
+  }
+
+KERNELS_LUM_ENERGY(sobel)
+KERNELS_LUM_ENERGY(scharr)
+KERNELS_LUM_ENERGY(l1)
+KERNELS_LUM_ENERGY(external)
+
+static void kernels_dp_row(const float *prev, const float *energy, float *dst,
+                           int width) {
+  if (width == 1) {
+    dst[0] = energy[0] + prev[0];
+    return;
+  }
+  dst[0] = energy[0] + (prev[1] < prev[0] ? prev[1] : prev[0]);
+  for (int x = 1; x < width - 1; x++) {
+    float m = prev[x] < prev[x - 1] ? prev[x] : prev[x - 1];
+    m = prev[x + 1] < m ? prev[x + 1] : m;
+    dst[x] = energy[x] + m;
+  }
+  float last = prev[width - 1] < prev[width - 2] ? prev[width - 1]
+                                                 : prev[width - 2];
+  dst[width - 1] = energy[width - 1] + last;
+}
+
+static void kernels_continue_dp(const float *prev, Mat mat, Mat dp) {
+  NOB_ASSERT(MAT_SAME_DIM(mat, dp) && "target and source must be of same size");
+  if (prev != NULL)
+    kernels_dp_row(prev, &MAT_AT(mat, 0, 0), &MAT_AT(dp, 0, 0), mat.width);
+  else if (dp.items != mat.items)
+    memcpy(&MAT_AT(dp, 0, 0), &MAT_AT(mat, 0, 0), mat.width * sizeof(float));
+  for (int y = 1; y < mat.height; y++) {
+    kernels_dp_row(&MAT_AT(dp, y - 1, 0), &MAT_AT(mat, y, 0),
+                   &MAT_AT(dp, y, 0), mat.width);
+  }
+}
+
+static void kernels_build_dp(Mat mat, Mat dp) {
+  kernels_continue_dp(NULL, mat, dp);
+}
+
+// Same as build_dirs in carve.h. The steps of a row go to a byte per pixel
+// first so the row vectorizes like kernels_dp_row, then get packed four to a
+// byte.
+static float kernels_build_dirs(Mat mat, uint8_t *dirs, int *last,
+                                float *scratch) {
+  int width = mat.width, stride = (width + 3) / 4;
+  float *prev = scratch, *cur = scratch + width;
+  // the bytes past the width only pad the last packed byte
+  uint8_t *step = (uint8_t *)(scratch + 2 * width);
+  memset(step + width, 0, 4 * stride - width);
+  memcpy(prev, &MAT_AT(mat, 0, 0), width * sizeof(float));
+  for (int y = 1; y < mat.height; y++) {
+    const float *energy = &MAT_AT(mat, y, 0);
+    if (width == 1) {
+      cur[0] = energy[0] + prev[0];
+      step[0] = 1;
+    } else {
+      bool right = prev[1] < prev[0];
+      cur[0] = energy[0] + (right ? prev[1] : prev[0]);
+      step[0] = right ? 2 : 1;
+      for (int x = 1; x < width - 1; x++) {
+        int l = prev[x - 1] < prev[x];
+        float m = prev[x - 1] < prev[x] ? prev[x - 1] : prev[x];
+        int r = prev[x + 1] < m;
+        cur[x] = energy[x] + (prev[x + 1] < m ? prev[x + 1] : m);
+        // 0 for left, 1 straight up and 2 for right, without branches
+        step[x] = 1 + r - l + (r & l);
+      }
+      int x = width - 1;
+      bool left = prev[x - 1] < prev[x];
+      cur[x] = energy[x] + (left ? prev[x - 1] : prev[x]);
+      step[x] = left ? 0 : 1;
+    }
+    uint8_t *d = dirs + (size_t)y * stride;
+    for (int i = 0; i < stride; i++)
+      d[i] = step[4 * i] | step[4 * i + 1] << 2 | step[4 * i + 2] << 4 |
+             step[4 * i + 3] << 6;
+    float *t = prev;
+    prev = cur;
+    cur = t;
+  }
+  int x = 0;
+  for (int i = 0; i < width; i++) {
+    if (prev[x] > prev[i])
+      x = i;
+  }
+  *last = x;
+  return prev[x];
+}
+
+// Same as update_dp in carve.h, but every row is computed into the scratch
+// row first, which vectorizes like kernels_dp_row, and only then compared
+// from both ends to find the columns that changed.
+static void kernels_update_dp(Mat edges, Mat dp, const int *seam,
+                              const int *lo, const int *hi, float *next) {
+  NOB_ASSERT(MAT_SAME_DIM(edges, dp) &&
+             "target and source must be of same size");
+  int width = edges.width;
+  int from = 0, to = -1;
+  for (int y = 0; y < edges.height; y++) {
+    float *row = &MAT_AT(dp, y, 0);
+    memmove(row + seam[y], row + seam[y] + 1,
+            (width - seam[y]) * sizeof(float));
+    int a = lo[y], b = hi[y];
+    if (from <= to) {
+      a = from - 1 < a ? from - 1 : a;
+      b = to + 1 > b ? to + 1 : b;
+    }
+    a = a < 0 ? 0 : a;
+    b = b >= width ? width - 1 : b;
+
+    const float *energy = &MAT_AT(edges, y, 0);
+    if (y == 0) {
+      memcpy(next + a, energy + a, (b - a + 1) * sizeof(float));
+    } else {
+      const float *prev = &MAT_AT(dp, y - 1, 0);
+      int first = a > 0 ? a : 1, last = b < width - 1 ? b : width - 2;
+      for (int x = first; x <= last; x++) {
+        float m = prev[x] < prev[x - 1] ? prev[x] : prev[x - 1];
+        m = prev[x + 1] < m ? prev[x + 1] : m;
+        next[x] = energy[x] + m;
+      }
+      if (width == 1) {
+        next[0] = energy[0] + prev[0];
+      } else {
+        if (a == 0)
+          next[0] = energy[0] + (prev[1] < prev[0] ? prev[1] : prev[0]);
+        if (b == width - 1)
+          next[b] = energy[b] + (prev[b] < prev[b - 1] ? prev[b] : prev[b - 1]);
+      }
+    }
+
+    from = a;
+    while (from <= b && next[from] == row[from])
+      from++;
+    to = b;
+    while (to >= from && next[to] == row[to])
+      to--;
+    if (from <= to)
+      memcpy(row + from, next + from, (to - from + 1) * sizeof(float));
+  }
+}
+
+// The float planes are shifted in the same pass over the row as the pixels,
+// so the tail of each row only streams through the cache once, and the mask
+// bytes are one memmove. Every pixel is moved as a single value of its size,
+// one copy of the loop per pixel size.
+#define KERNELS_REMOVE_SEAM(name, pixel_type)                                  \
+  static int name(const int *seam, Raster img, Mat lum, Mat edges,             \
+                  Mask mask) {                                                 \
+    int removed = 0;                                                           \
+    for (int y = 0; y < img.height; y++) {                                     \
+      pixel_type *px = (pixel_type *)raster_row(img, y);                       \
+      float *e = &MAT_AT(edges, y, 0);                                         \
+      int n = img.width - 1 - seam[y];                                         \
+      if (mask.items) {                                                        \
+        uint8_t *m = &MAT_AT(mask, y, seam[y]);                                \
+        removed += m[0] == MASK_REMOVE;                                        \
+        memmove(m, m + 1, n);                                                  \
+      }                                                                        \
+      /* the color energies keep no luminance */                               \
+      if (lum.items == NULL) {                                                 \
+        for (int x = seam[y]; x < img.width - 1; x++) {                        \
+          px[x] = px[x + 1];                                                   \
+          e[x] = e[x + 1];                                                     \
+        }                                                                      \
+        continue;                                                              \
+      }                                                                        \
+      float *l = &MAT_AT(lum, y, 0);                                           \
+      for (int x = seam[y]; x < img.width - 1; x++) {                          \
+        px[x] = px[x + 1];                                                     \
+        l[x] = l[x + 1];                                                       \
+        e[x] = e[x + 1];                                                       \
+      }                                                                        \
+    }                                                                          \
+    return removed;                                                            \
+  }
+
+// The odd sizes (3 channels, or 1 and 2 of 16 bit) are arrays of their
+// channels, which the compiler still copies as a few wider moves.
+typedef struct {
+  uint8_t c[3];
+} Kernels_Pixel24;
+
+typedef struct {
+  uint16_t c[3];
+} Kernels_Pixel48;
+
+typedef struct {
+  uint32_t c[3];
+} Kernels_Pixel96;
+
+typedef struct {
+  uint64_t lo;
+  uint64_t hi;
+} Kernels_Pixel128;
+
+KERNELS_REMOVE_SEAM(kernels_remove_seam_8, uint8_t)
+KERNELS_REMOVE_SEAM(kernels_remove_seam_16, uint16_t)
+KERNELS_REMOVE_SEAM(kernels_remove_seam_24, Kernels_Pixel24)
+KERNELS_REMOVE_SEAM(kernels_remove_seam_32, uint32_t)
+KERNELS_REMOVE_SEAM(kernels_remove_seam_48, Kernels_Pixel48)
+KERNELS_REMOVE_SEAM(kernels_remove_seam_64, uint64_t)
+KERNELS_REMOVE_SEAM(kernels_remove_seam_96, Kernels_Pixel96)
+KERNELS_REMOVE_SEAM(kernels_remove_seam_128, Kernels_Pixel128)
+
+static int kernels_remove_seam(const int *seam, Raster img, Mat lum,
+                               Mat edges, Mask mask) {
+  switch (raster_pixel_size(img)) {
+  case 1:
+    return kernels_remove_seam_8(seam, img, lum, edges, mask);
+  case 2:
+    return kernels_remove_seam_16(seam, img, lum, edges, mask);
+  case 3:
+    return kernels_remove_seam_24(seam, img, lum, edges, mask);
+  case 4:
+    return kernels_remove_seam_32(seam, img, lum, edges, mask);
+  case 6:
+    return kernels_remove_seam_48(seam, img, lum, edges, mask);
+  case 8:
+    return kernels_remove_seam_64(seam, img, lum, edges, mask);
+  case 12:
+    return kernels_remove_seam_96(seam, img, lum, edges, mask);
+  case 16:
+    return kernels_remove_seam_128(seam, img, lum, edges, mask);
+  default:
+    NOB_ASSERT(0 && "unreachable");
+    return 0;
+  }
+}
+
+// One channel of a row of img as floats scaled like raster_sample, one loop
+// per depth and channel count.
+#define KERNELS_SAMPLE_ROW(type, n, scale)                                     \
+  do {                                                                         \
+    const type *src = (const type *)raster_row(img, y);                        \
+    for (int x = 0; x < img.width; x++)                                        \
+      dst[x] = (float)src[n * x + c] / scale;                                  \
+  } while (0)
+
+#define KERNELS_SAMPLE_ROWS(type, scale)                                       \
+  do {                                                                         \
+    switch (img.channels) {                                                    \
+    case 1:                                                                    \
+      KERNELS_SAMPLE_ROW(type, 1, scale);                                      \
+      break;                                                                   \
+    case 2:                                                                    \
+      KERNELS_SAMPLE_ROW(type, 2, scale);                                      \
+      break;                                                                   \
+    case 3:                                                                    \
+      KERNELS_SAMPLE_ROW(type, 3, scale);                                      \
+      break;                                                                   \
+    default:                                                                   \
+      KERNELS_SAMPLE_ROW(type, 4, scale);                                      \
+      break;                                                                   \
+    }                                                                          \
+  } while (0)
+
+static void kernels_sample_row(Raster img, int y, int c, float *dst) {
+  if (img.depth == DEPTH_8)
+    KERNELS_SAMPLE_ROWS(uint8_t, 255.0f);
+  else if (img.depth == DEPTH_16)
+    KERNELS_SAMPLE_ROWS(uint16_t, 65535.0f);
+  else
+    KERNELS_SAMPLE_ROWS(float, 1.0f);
+}
+
+// Folds the magnitudes of one more channel into the color energy.
+static void kernels_color_combine(Energy_Kind energy, float *dst,
+                                  const float *magnitude, int width) {
+  if (energy == ENERGY_COLOR_MAX) {
+    for (int x = 0; x < width; x++)
+      dst[x] = magnitude[x] > dst[x] ? magnitude[x] : dst[x];
+  } else {
+    for (int x = 0; x < width; x++)
+      dst[x] = dst[x] + magnitude[x];
+  }
+}
+
+// Every channel is unpacked once per row into three rolling rows, so the
+// energy needs a few rows of scratch instead of a float plane per channel,
+// and the sobel of each channel is the same vector loop as for the
+// luminance.
+static inline void kernels_color_energy_filter(Raster img, Energy_Kind energy,
+                                               Mask mask, Mat grad,
+                                               const float *zeros) {
+  NOB_ASSERT(MAT_SAME_DIM(img, grad) &&
+             "target and source must be of same size");
+  int width = img.width, height = img.height, count = color_channels(img);
+  float *rows = calloc((size_t)(3 * count + 1) * width, sizeof(float));
+  NOB_ASSERT(rows != NULL && "buy more ram lol");
+  float *magnitude = rows + (size_t)3 * count * width;
+#define KERNELS_SLOT(y, c) (rows + ((size_t)((y) % 3) * count + (c)) * width)
+  for (int c = 0; c < count; c++)
+    kernels_sample_row(img, 0, c, KERNELS_SLOT(0, c));
+  for (int y = 0; y < height; y++) {
+    for (int c = 0; y + 1 < height && c < count; c++)
+      kernels_sample_row(img, y + 1, c, KERNELS_SLOT(y + 1, c));
+    float *dst = &MAT_AT(grad, y, 0);
+    for (int c = 0; c < count; c++) {
+      const float *up = y > 0 ? KERNELS_SLOT(y - 1, c) : zeros;
+      const float *down = y + 1 < height ? KERNELS_SLOT(y + 1, c) : zeros;
+      kernels_sobel_row(up, KERNELS_SLOT(y, c), down, NULL,
+                        c == 0 ? dst : magnitude, width);
+      if (c > 0)
+        kernels_color_combine(energy, dst, magnitude, width);
+    }
+    if (mask.items) {
+      const uint8_t *m = &MAT_AT(mask, y, 0);
+      for (int x = 0; x < width; x++)
+        dst[x] = mask_energy(dst[x], m[x]);
+    }
+  }
+#undef KERNELS_SLOT
+  free(rows);
+}
+
+// Fills the window of kernels_color_energy_update for one depth.
+#define KERNELS_WINDOW(type, scale)                                            \
+  do {                                                                         \
+    for (int i = 0; i < 3; i++) {                                              \
+      if (y + i - 1 < 0 || y + i - 1 >= height)                                \
+        continue;                                                              \
+      const type *src = (const type *)raster_row(img, y + i - 1);              \
+      for (int j = 0; j < 6; j++) {                                            \
+        int x = a - 1 + j;                                                     \
+        if (x < 0 || x >= width)                                               \
+          continue;                                                            \
+        for (int c = 0; c < count; c++)                                        \
+          win[c][i][j] = (float)src[n * x + c] / scale;                        \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+// The pixels around the seam of every row are unpacked into a zero padded
+// window of three rows and six columns per channel, then the four energies
+// are computed with fixed counts like in kernels_sobel_update.
+static inline void kernels_color_energy_update(const int *seam, Raster img,
+                                               Energy_Kind energy, Mat edges,
+                                               Mask mask, int *lo, int *hi) {
+  int width = img.width, height = img.height, count = color_channels(img);
+  int n = img.channels;
+  for (int y = 0; y < height; y++) {
+    int a = seam[y] - 2 < 0 ? 0 : seam[y] - 2;
+    int b = seam[y] + 1 >= width ? width - 1 : seam[y] + 1;
+    if (lo != NULL) {
+      lo[y] = a;
+      hi[y] = b;
+    }
+    // column j of the window is column a - 1 + j of the image
+    float win[3][3][6] = {0};
+    if (img.depth == DEPTH_8)
+      KERNELS_WINDOW(uint8_t, 255.0f);
+    else if (img.depth == DEPTH_16)
+      KERNELS_WINDOW(uint16_t, 65535.0f);
+    else
+      KERNELS_WINDOW(float, 1.0f);
+    float out[4] = {0};
+    for (int c = 0; c < count; c++) {
+      const float *up = win[c][0], *mid = win[c][1], *down = win[c][2];
+      for (int i = 0; i < 4; i++) {
+        int x = i + 1;
+        float vx = up[x - 1] - up[x + 1] + 2 * mid[x - 1] - 2 * mid[x + 1] +
+                   down[x - 1] - down[x + 1];
+        float vy = up[x - 1] + 2 * up[x] + up[x + 1] - down[x - 1] -
+                   2 * down[x] - down[x + 1];
+        float magnitude = sqrtf(vx * vx + vy * vy);
+        if (c == 0)
+          out[i] = magnitude;
+        else if (energy == ENERGY_COLOR_MAX)
+          out[i] = magnitude > out[i] ? magnitude : out[i];
+        else
+          out[i] = out[i] + magnitude;
+      }
+    }
+    const uint8_t *m = mask.items ? &MAT_AT(mask, y, 0) : NULL;
+    float *dst = &MAT_AT(edges, y, 0);
+    for (int x = a; x <= b; x++)
+      dst[x] = m ? mask_energy(out[x - a], m[x]) : out[x - a];
+  }
+}
+
+// The color energies in the shape of Energy_Kernels, each with its own
+// copy of the loops for a constant energy.
+#define KERNELS_COLOR_ENERGY(name, energy)                                     \
+  static void kernels_##name##_filter(Raster img, Mat lum, Mask mask,          \
+                                      Mat grad, const float *zeros) {          \
+    (void)lum;                                                                 \
+    kernels_color_energy_filter(img, energy, mask, grad, zeros);               \
+  }                                                                            \
+                                                                               \
+  static void kernels_##name##_update(const int *seam, Raster img, Mat lum,    \
+                                      Mat edges, Mask mask, int *lo, int *hi,  \
+                                      const float *zeros) {                    \
+    (void)lum;                                                                 \
+    (void)zeros;                                                               \
+    kernels_color_energy_update(seam, img, energy, edges, mask, lo, hi);       \
+  }
+
+KERNELS_COLOR_ENERGY(color, ENERGY_COLOR)
+KERNELS_COLOR_ENERGY(color_max, ENERGY_COLOR_MAX)
+
+const Kernels KERNELS_CONCAT(kernels, KERNELS_ISA) = {
+    .name = KERNELS_STR(KERNELS_ISA),
+    .supported = kernels_supported,
+    .rgb_to_lum = kernels_rgb_to_lum,
+    .build_dp = kernels_build_dp,
+    .continue_dp = kernels_continue_dp,
+    .build_dirs = kernels_build_dirs,
+    .remove_seam = kernels_remove_seam,
+    .update_dp = kernels_update_dp,
+    .energies =
+        {
+            [ENERGY_SOBEL] = {kernels_sobel_filter, kernels_sobel_update},
+            [ENERGY_COLOR] = {kernels_color_filter, kernels_color_update},
+            [ENERGY_COLOR_MAX] = {kernels_color_max_filter,
+                                  kernels_color_max_update},
+            [ENERGY_SCHARR] = {kernels_scharr_filter, kernels_scharr_update},
+            [ENERGY_L1] = {kernels_l1_filter, kernels_l1_update},
+            [ENERGY_EXTERNAL] = {kernels_external_filter,
+                                 kernels_external_update},
+        },
+};
@@ -1,5 +1,5 @@
-#include <float.h>
-#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -8,165 +8,546 @@
 
 #define NOB_IMPL
 #include "nob.h"
+#define CARVE_IMPLEMENTATION
+#include "carve.h"
 #include "stb_image.h"
 #include "stb_image_write.h"
 
-typedef struct {
-  uint32_t red : 8;
-  uint32_t green : 8;
-  uint32_t blue : 8;
-  uint32_t alpha : 8;
-} Pixel;
+// stb_image_write.o has its deflate exported, the header does not declare it
+unsigned char *stbi_zlib_compress(unsigned char *data, int data_len,
+                                  int *out_len, int quality);
 
-typedef struct {
-  int height;
-  int width;
-  int stride;
-  Pixel *items;
-} Img;
+// Radiance files load as floats and 16 bit pngs as 16 bit, everything else
+// as 8 bit, all with the channels the file has: a gray scan stays a quarter
+// of the size it would have as RGBA.
+static bool load_raster(const char *path, Raster *img) {
+  *img = (Raster){0};
+  int *channels = &img->channels;
+  if (stbi_is_hdr(path)) {
+    img->depth = DEPTH_FLOAT;
+    img->items = stbi_loadf(path, &img->width, &img->height, channels, 0);
+  } else if (stbi_is_16_bit(path)) {
+    img->depth = DEPTH_16;
+    img->items = stbi_load_16(path, &img->width, &img->height, channels, 0);
+  } else {
+    img->items = stbi_load(path, &img->width, &img->height, channels, 0);
+  }
+  img->stride = img->width;
+  return img->items != NULL;
+}
 
-typedef struct {
-  int height;
-  int width;
-  int stride;
-  float *items;
-} Mat;
-
-#define mat_alloc(mat_kind, m_name, m_height, m_width)                         \
-  NOB_ASSERT((m_width) > 0 && (m_height) > 0 &&                                \
-             "enter valid matrix dimensions");                                 \
-  mat_kind m_name = {0};                                                       \
-  do {                                                                         \
-    m_name.height = m_height;                                                  \
-    m_name.stride = m_name.width = m_width;                                    \
-    m_name.items =                                                             \
-        NOB_REALLOC(NULL, sizeof(*m_name.items) * (m_width) * (m_height));     \
-    NOB_ASSERT(m_name.items != NULL && "buy more ram lol");                    \
-  } while (0)
-
-#define MAT_AT(m, y, x) (m).items[(x) + (y) * (m).stride]
-#define MAT_WITHIN(m, y, x)                                                    \
-  (0 <= (y) && 0 <= (x) && (y) < (m).height && (x) < (m).width)
-#define MAT_SAME_DIM(m1, m2)                                                   \
-  ((m1).width == (m2).width && (m1).height == (m2).height)
-
-static float pixel_to_lum(Pixel pixel) {
-  /* (0.299*R + 0.587*G + 0.114*B) */
-  return (0.299 * pixel.red + 0.587 * pixel.green + 0.114 * pixel.blue) / 255.0;
-}
-
-static void rgb_to_lum(Img img, Mat lum) {
-  NOB_ASSERT(MAT_SAME_DIM(img, lum) &&
-             "target and source must be of same size");
-  for (int y = 0; y < img.height; y++) {
-    for (int x = 0; x < img.width; x++) {
-      MAT_AT(lum, y, x) = pixel_to_lum(MAT_AT(img, y, x));
+static uint32_t png_crc(const uint8_t *data, size_t len, uint32_t crc) {
+  static uint32_t table[256];
+  if (table[1] == 0) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      table[i] = c;
     }
   }
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++)
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
 }
 
-static float sobel_filter_at(Mat lum, int row, int col) {
-  static int fltr_conv_krnl[3][3] = {{1, 0, -1}, {2, 0, -2}, {1, 0, -1}};
-  float vx = 0.0, vy = 0.0;
-  for (int ci = -1; ci < 2; ci++) {
-    for (int cj = -1; cj < 2; cj++) {
-      if (MAT_WITHIN(lum, row + ci, col + cj)) {
-        vx += fltr_conv_krnl[ci + 1][cj + 1] * MAT_AT(lum, row + ci, col + cj);
-        vy += fltr_conv_krnl[cj + 1][ci + 1] * MAT_AT(lum, row + ci, col + cj);
-      }
+static void png_put32(uint8_t *dst, uint32_t value) {
+  dst[0] = value >> 24;
+  dst[1] = value >> 16;
+  dst[2] = value >> 8;
+  dst[3] = value;
+}
+
+static bool png_chunk(FILE *f, const char *type, const uint8_t *data,
+                      uint32_t len) {
+  uint8_t head[8];
+  png_put32(head, len);
+  memcpy(head + 4, type, 4);
+  uint8_t tail[4];
+  png_put32(tail, png_crc(data, len, png_crc(head + 4, 4, 0)));
+  return fwrite(head, 8, 1, f) == 1 && (len == 0 || fwrite(data, len, 1, f)) &&
+         fwrite(tail, 4, 1, f) == 1;
+}
+
+// stbi_write_png only writes 8 bits per channel. Every row gets the up
+// filter, which alone does most of what the filters can do for photos, and
+// the samples are stored big endian as png wants them.
+static bool write_png16(const char *path, Raster img) {
+  int samples = img.width * img.channels;
+  size_t row_size = 1 + (size_t)samples * 2;
+  size_t size = row_size * img.height;
+  if (size > INT32_MAX) {
+    nob_log(NOB_ERROR, "%s is too large for a 16 bit png", path);
+    return false;
+  }
+  uint8_t *raw = NOB_REALLOC(NULL, size);
+  NOB_ASSERT(raw != NULL && "buy more ram lol");
+  for (int y = 0; y < img.height; y++) {
+    uint8_t *dst = raw + y * row_size;
+    const uint16_t *src = (const uint16_t *)raster_row(img, y);
+    const uint16_t *above = y > 0 ? (const uint16_t *)raster_row(img, y - 1)
+                                  : NULL;
+    dst[0] = 2;
+    for (int i = 0; i < samples; i++) {
+      uint16_t v = src[i], up = above ? above[i] : 0;
+      dst[1 + 2 * i] = (v >> 8) - (up >> 8);
+      dst[2 + 2 * i] = (v & 0xff) - (up & 0xff);
     }
   }
-  return sqrtf((vx * vx + vy * vy));
+  int zlen;
+  uint8_t *zlib = stbi_zlib_compress(raw, size, &zlen, 8);
+  NOB_FREE(raw);
+  NOB_ASSERT(zlib != NULL && "buy more ram lol");
+
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    free(zlib);
+    return false;
+  }
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a,
+                                       '\n'};
+  uint8_t ihdr[13] = {0};
+  png_put32(ihdr, img.width);
+  png_put32(ihdr + 4, img.height);
+  // gray, gray and alpha, RGB and RGBA
+  static const uint8_t color_type[5] = {0, 0, 4, 2, 6};
+  ihdr[8] = 16; // bits per channel
+  ihdr[9] = color_type[img.channels];
+  bool ok = fwrite(signature, sizeof(signature), 1, f) == 1 &&
+            png_chunk(f, "IHDR", ihdr, sizeof(ihdr)) &&
+            png_chunk(f, "IDAT", zlib, zlen) && png_chunk(f, "IEND", NULL, 0);
+  free(zlib);
+  return fclose(f) == 0 && ok;
 }
 
-static void sobel_filter(Mat lum, Mat grad) {
-  NOB_ASSERT(MAT_SAME_DIM(lum, grad) &&
-             "target and source must be of same size");
-  for (int y = 0; y < lum.height; y++) {
-    for (int x = 0; x < lum.width; x++) {
-      MAT_AT(grad, y, x) = sobel_filter_at(lum, y, x);
+// Writes img in its own depth: 8 and 16 bit pngs, floats only as Radiance
+// .hdr. stbi_write_hdr has no stride, so float rows get packed in place.
+static bool write_raster(const char *path, Raster img) {
+  switch (img.depth) {
+  case DEPTH_8:
+    return stbi_write_png(path, img.width, img.height, img.channels, img.items,
+                          img.stride * raster_pixel_size(img));
+  case DEPTH_16:
+    return write_png16(path, img);
+  case DEPTH_FLOAT: {
+    size_t len = strlen(path);
+    if (len < 4 || strcmp(path + len - 4, ".hdr") != 0) {
+      nob_log(NOB_ERROR, "float images are only written as .hdr: %s", path);
+      return false;
     }
+    for (int y = 1; y < img.height; y++)
+      memmove((float *)img.items + (size_t)y * img.width * img.channels,
+              raster_row(img, y), img.width * raster_pixel_size(img));
+    return stbi_write_hdr(path, img.width, img.height, img.channels,
+                          img.items);
+  }
+  default:
+    NOB_ASSERT(0 && "unreachable");
+    return false;
   }
 }
 
-static void build_dp(Mat mat, Mat dp) {
-  NOB_ASSERT(MAT_SAME_DIM(mat, dp) && "target and source must be of same size");
-  for (int x = 0; x < mat.width; x++) {
-    MAT_AT(dp, 0, x) = MAT_AT(mat, 0, x);
+// Green pixels of the mask image are protected, red ones are removed first.
+static bool load_mask(const char *path, Raster img, Mask *mask) {
+  int width, height;
+  Pixel *items =
+      (Pixel *)stbi_load(path, &width, &height, NULL, STBI_rgb_alpha);
+  if (items == NULL) {
+    nob_log(NOB_ERROR, "unable to read mask: %s", path);
+    return false;
   }
-  for (int y = 1; y < mat.height; y++) {
-    for (int x = 0; x < mat.width; x++) {
-      float min_prev = FLT_MAX;
-      for (int i = -1; i < 2; i++) {
-        if (x + i >= 0 && x + i < mat.width &&
-            min_prev > MAT_AT(dp, y - 1, x + i)) {
-          min_prev = MAT_AT(dp, y - 1, x + i);
-        }
-      }
-      MAT_AT(dp, y, x) = MAT_AT(mat, y, x) + min_prev;
-    }
+  if (width != img.width || height != img.height) {
+    nob_log(NOB_ERROR, "mask %s is %dx%d, the image is %dx%d", path, width,
+            height, img.width, img.height);
+    stbi_image_free(items);
+    return false;
+  }
+  mask->height = height;
+  mask->stride = mask->width = width;
+  mask->items = NOB_REALLOC(NULL, (size_t)width * height);
+  NOB_ASSERT(mask->items != NULL && "buy more ram lol");
+  for (size_t i = 0; i < (size_t)width * height; i++) {
+    Pixel p = items[i];
+    mask->items[i] = p.green >= 128 && p.red < 128   ? MASK_PROTECT
+                     : p.red >= 128 && p.green < 128 ? MASK_REMOVE
+                                                     : MASK_NONE;
+  }
+  stbi_image_free(items);
+  return true;
+}
+
+// The gray levels of the map image are the energy, 0 to 1 for 8 and 16 bit
+// images and as they are for .hdr ones: bright pixels are kept, dark ones
+// carved first.
+static bool load_energy_map(const char *path, Raster img, Mat *map) {
+  int width, height;
+  void *items;
+  Pixel_Depth depth = DEPTH_8;
+  if (stbi_is_hdr(path)) {
+    depth = DEPTH_FLOAT;
+    items = stbi_loadf(path, &width, &height, NULL, 1);
+  } else if (stbi_is_16_bit(path)) {
+    depth = DEPTH_16;
+    items = stbi_load_16(path, &width, &height, NULL, 1);
+  } else {
+    items = stbi_load(path, &width, &height, NULL, 1);
+  }
+  if (items == NULL) {
+    nob_log(NOB_ERROR, "unable to read energy map: %s", path);
+    return false;
   }
+  if (width != img.width || height != img.height) {
+    nob_log(NOB_ERROR, "energy map %s is %dx%d, the image is %dx%d", path,
+            width, height, img.width, img.height);
+    stbi_image_free(items);
+    return false;
+  }
+  map->height = height;
+  map->stride = map->width = width;
+  map->items = NOB_REALLOC(NULL, (size_t)width * height * sizeof(float));
+  NOB_ASSERT(map->items != NULL && "buy more ram lol");
+  for (size_t i = 0; i < (size_t)width * height; i++) {
+    map->items[i] = depth == DEPTH_FLOAT ? ((float *)items)[i]
+                    : depth == DEPTH_16  ? ((uint16_t *)items)[i] / 65535.0f
+                                         : ((uint8_t *)items)[i] / 255.0f;
+  }
+  stbi_image_free(items);
+  return true;
+}
+
+// Frames in flight between the decoder, the carver and the encoder.
+#define FRAME_QUEUE_CAP 4
+
+typedef struct {
+  // NULL items end the sequence
+  Raster img;
+  size_t index;
+} Frame;
+
+typedef struct {
+  Frame items[FRAME_QUEUE_CAP];
+  size_t head;
+  size_t count;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+} Frame_Queue;
+
+typedef struct {
+  const char *input_dir;
+  const char *output_dir;
+  NOB_File_Paths names;
+  Frame_Queue decoded;
+  Frame_Queue carved;
+  bool volume;
+  atomic_bool failed;
+} Sequence;
+
+static void frame_queue_init(Frame_Queue *q) {
+  memset(q, 0, sizeof(*q));
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->not_full, NULL);
 }
 
-static void mat_rm_col_at_row(Mat mat, int row, int col) {
-  float *mat_row = &MAT_AT(mat, row, 0);
-  memmove(mat_row + col, mat_row + col + 1,
-          (mat.width - col - 1) * sizeof(float));
+static void frame_queue_push(Frame_Queue *q, Frame frame) {
+  pthread_mutex_lock(&q->lock);
+  while (q->count == FRAME_QUEUE_CAP)
+    pthread_cond_wait(&q->not_full, &q->lock);
+  q->items[(q->head + q->count++) % FRAME_QUEUE_CAP] = frame;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
 }
 
-static void img_rm_col_at_row(Img img, int row, int col) {
-  Pixel *pixel_row = &MAT_AT(img, row, 0);
-  memmove(pixel_row + col, pixel_row + col + 1,
-          (img.width - col - 1) * sizeof(Pixel));
+static Frame frame_queue_pop(Frame_Queue *q) {
+  pthread_mutex_lock(&q->lock);
+  while (q->count == 0)
+    pthread_cond_wait(&q->not_empty, &q->lock);
+  Frame frame = q->items[q->head];
+  q->head = (q->head + 1) % FRAME_QUEUE_CAP;
+  q->count--;
+  pthread_cond_signal(&q->not_full);
+  pthread_mutex_unlock(&q->lock);
+  return frame;
 }
 
-static void remove_seam(Mat dp, Img img, Mat lum, Mat edges) {
-  int y = dp.height - 1;
-  int seam = 0;
+static int name_compare(const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
 
-  for (int i = 0; i < dp.width; i++) {
-    if (MAT_AT(dp, y, seam) > MAT_AT(dp, y, i)) {
-      seam = i;
+static void *sequence_decode(void *arg) {
+  Sequence *seq = arg;
+  char path[4096];
+  for (size_t i = 0; i < seq->names.count && !seq->failed; i++) {
+    snprintf(path, sizeof(path), "%s/%s", seq->input_dir, seq->names.items[i]);
+    Frame frame = {.index = i};
+    if (seq->volume) {
+      frame.img = (Raster){.depth = DEPTH_8, .channels = 4};
+      frame.img.items = stbi_load(path, &frame.img.width, &frame.img.height,
+                                  NULL, STBI_rgb_alpha);
+      frame.img.stride = frame.img.width;
+    } else {
+      load_raster(path, &frame.img);
     }
+    if (frame.img.items == NULL) {
+      nob_log(NOB_ERROR, "unable to read file: %s", path);
+      seq->failed = true;
+      break;
+    }
+    frame_queue_push(&seq->decoded, frame);
   }
+  frame_queue_push(&seq->decoded, (Frame){0});
+  return NULL;
+}
 
-  img_rm_col_at_row(img, y, seam);
-  mat_rm_col_at_row(lum, y, seam);
-  mat_rm_col_at_row(edges, y, seam);
-  while (--y) {
-    int seam_rm = seam;
-    for (int dx = -1; dx < 2; dx++) {
-      if (seam + dx >= 0 && seam + dx < dp.width &&
-          MAT_AT(dp, y, seam_rm) > MAT_AT(dp, y, seam + dx)) {
-        seam_rm = seam + dx;
-      }
+// Every frame is written under the name of its input, as .hdr when it is
+// float and as png otherwise.
+static void *sequence_encode(void *arg) {
+  Sequence *seq = arg;
+  char path[4096];
+  for (;;) {
+    Frame frame = frame_queue_pop(&seq->carved);
+    if (frame.img.items == NULL)
+      break;
+    const char *name = seq->names.items[frame.index];
+    const char *dot = strrchr(name, '.');
+    int len = dot ? (int)(dot - name) : (int)strlen(name);
+    const char *ext = frame.img.depth == DEPTH_FLOAT ? "hdr" : "png";
+    snprintf(path, sizeof(path), "%s/%.*s.%s", seq->output_dir, len, name,
+             ext);
+    if (!seq->failed && !write_raster(path, frame.img)) {
+      nob_log(NOB_ERROR, "cannot write to file: %s", path);
+      seq->failed = true;
     }
+    stbi_image_free(frame.img.items);
+  }
+  return NULL;
+}
 
-    img_rm_col_at_row(img, y, seam_rm);
-    mat_rm_col_at_row(lum, y, seam_rm);
-    mat_rm_col_at_row(edges, y, seam_rm);
-    for (int dx = -2; dx < 2; dx++) {
-      if (seam + dx >= 0 && seam + dx < lum.width - 1) {
-        MAT_AT(edges, y + 1, seam + dx) =
-            sobel_filter_at(lum, y + 1, seam + dx);
-      }
-    }
-    seam = seam_rm;
+// Carves every frame in input_dir to the same size, in name order, with the
+// seams of each frame as the prior of the next one. Decoding and encoding
+// run on their own threads, so the carve only waits on them when they are
+// slower than it. Frames keep the depth and channels of their files, except
+// for a volume carve: it needs every frame at once as 8 bit RGBA, collects
+// them all first and hands them on once carve_volume is done.
+static bool carve_sequence(const char *input_dir, const char *output_dir,
+                           Carve_Opts opts, bool volume) {
+  Sequence seq = {
+      .input_dir = input_dir,
+      .output_dir = output_dir,
+      .volume = volume,
+  };
+  NOB_File_Paths children = {0};
+  if (!nob_read_entire_dir(input_dir, &children))
+    return false;
+  for (size_t i = 0; i < children.count; i++) {
+    if (children.items[i][0] != '.')
+      nob_da_append(&seq.names, children.items[i]);
+  }
+  qsort(seq.names.items, seq.names.count, sizeof(*seq.names.items),
+        name_compare);
+  if (seq.names.count == 0) {
+    nob_log(NOB_ERROR, "no frames in %s", input_dir);
+    return false;
   }
-  for (int dx = -2; dx < 2; dx++) {
-    if (seam + dx >= 0 && seam + dx < lum.width - 1) {
-      MAT_AT(edges, 0, seam + dx) = sobel_filter_at(lum, 0, seam + dx);
+  if (!nob_mkdir_if_not_exists(output_dir))
+    return false;
+
+  frame_queue_init(&seq.decoded);
+  frame_queue_init(&seq.carved);
+  pthread_t decoder, encoder;
+  pthread_create(&decoder, NULL, sequence_decode, &seq);
+  pthread_create(&encoder, NULL, sequence_encode, &seq);
+
+  Carve_Arena arena = {0};
+  Seam_Stream seams[2] = {0};
+  Img *clip = NULL;
+  size_t clip_count = 0;
+  int width = 0, height = 0;
+  for (size_t n = 0;; n++) {
+    Frame frame = frame_queue_pop(&seq.decoded);
+    if (frame.img.items == NULL)
+      break;
+    if (n == 0) {
+      width = frame.img.width;
+      height = frame.img.height;
+    } else if (frame.img.width != width || frame.img.height != height) {
+      nob_log(NOB_ERROR, "%s is %dx%d, the first frame is %dx%d",
+              seq.names.items[frame.index], frame.img.width,
+              frame.img.height, width, height);
+      seq.failed = true;
+    }
+    if (volume) {
+      clip = NOB_REALLOC(clip, (clip_count + 1) * sizeof(*clip));
+      NOB_ASSERT(clip != NULL && "buy more ram lol");
+      clip[clip_count++] = (Img){
+          .height = frame.img.height,
+          .width = frame.img.width,
+          .stride = frame.img.stride,
+          .items = frame.img.items,
+      };
+      continue;
     }
+    // after a failure frames are only passed on to be freed
+    if (!seq.failed) {
+      opts.seams = &seams[n % 2];
+      opts.prior = n > 0 ? &seams[(n + 1) % 2] : NULL;
+      frame.img = carve_raster(frame.img, opts, &arena);
+    }
+    frame_queue_push(&seq.carved, frame);
+  }
+  if (volume) {
+    // frames come in name order, so their index is their place in the clip
+    if (!seq.failed && clip_count > 0)
+      carve_volume(clip, clip_count, opts);
+    for (size_t i = 0; i < clip_count; i++)
+      frame_queue_push(&seq.carved,
+                       (Frame){.img = img_raster(clip[i]), .index = i});
+    NOB_FREE(clip);
+  }
+  frame_queue_push(&seq.carved, (Frame){0});
+  pthread_join(decoder, NULL);
+  pthread_join(encoder, NULL);
+
+  if (!seq.failed)
+    nob_log(NOB_INFO, "carved %zu frames", seq.names.count);
+  seam_stream_free(&seams[0]);
+  seam_stream_free(&seams[1]);
+  carve_arena_free(&arena);
+  nob_da_free(seq.names);
+  nob_da_free(children);
+  return !seq.failed;
+}
+
+// Prints what -t and -P collected and closes the trace of -T, for images
+// and frame sequences alike.
+static void finish_stats(bool report, Carve_Stats *stats) {
+  if (report)
+    carve_stats_report(stats);
+  if (stats->perf != NULL) {
+    carve_perf_report(stats);
+    carve_perf_close(stats->perf);
+  }
+  if (stats->trace != NULL) {
+    carve_stats_flush(stats);
+    carve_trace_close(stats->trace);
   }
 }
 
 static void usage(const char *program) {
-  nob_log(NOB_ERROR, "Usage: %s <input> <output>\n", program);
+  nob_log(NOB_ERROR,
+          "Usage: %s [-t] [-P] [-T <trace.json>] [-k <kernels>] [-w <width>] "
+          "[-H <height>] [-o <order>] [-d <dp>] "
+          "[-e <energy>] [-l <lum>] [-p <proxy>] [-b <band>] [-s <seams.bin>] "
+          "[-r <seams.bin>] [-m <mask.png>] [-E <map.png>] [-O] [-R] [-G] "
+          "<input> <output>\n",
+          program);
 }
 
 int main(int argc, char **argv) {
   const char *program = nob_shift_args(&argc, &argv);
 
+  Carve_Opts opts = {0};
+  Carve_Stats stats = {0};
+  Carve_Trace trace = {0};
+  Carve_Perf perf = {0};
+  bool report = false;
+  Seam_Stream seams = {0};
+  const char *seams_path = NULL;
+  const char *replay_path = NULL;
+  const char *mask_path = NULL;
+  const char *map_path = NULL;
+  bool volume = false;
+  while (argc > 0 && argv[0][0] == '-') {
+    const char *flag = nob_shift_args(&argc, &argv);
+    if (strcmp(flag, "-t") == 0) {
+      opts.stats = &stats;
+      report = true;
+      continue;
+    }
+    if (strcmp(flag, "-P") == 0) {
+      if (carve_perf_open(&perf))
+        stats.perf = &perf;
+      opts.stats = &stats;
+      continue;
+    }
+    if (strcmp(flag, "-O") == 0) {
+      opts.object_removal = true;
+      continue;
+    }
+    if (strcmp(flag, "-R") == 0) {
+      opts.restore_width = true;
+      continue;
+    }
+    if (strcmp(flag, "-G") == 0) {
+      volume = true;
+      continue;
+    }
+    if (argc <= 0) {
+      usage(program);
+      nob_log(NOB_ERROR, "no value provided for %s", flag);
+      return EXIT_FAILURE;
+    }
+    const char *value = nob_shift_args(&argc, &argv);
+    if (strcmp(flag, "-w") == 0) {
+      opts.target_width = atoi(value);
+    } else if (strcmp(flag, "-H") == 0) {
+      opts.target_height = atoi(value);
+    } else if (strcmp(flag, "-o") == 0) {
+      if (!order_by_name(value, &opts.order)) {
+        nob_log(NOB_ERROR, "unknown order: %s", value);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(flag, "-l") == 0) {
+      if (!lum_model_by_name(value, &opts.lum_model)) {
+        nob_log(NOB_ERROR, "unknown luminance model: %s", value);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(flag, "-d") == 0) {
+      if (!dp_mode_by_name(value, &opts.dp)) {
+        nob_log(NOB_ERROR, "unknown dp mode: %s", value);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(flag, "-T") == 0) {
+      if (!carve_trace_open(&trace, value))
+        return EXIT_FAILURE;
+      stats.trace = &trace;
+      opts.stats = &stats;
+    } else if (strcmp(flag, "-k") == 0) {
+      opts.kernels = kernels_select(value);
+      if (opts.kernels == NULL)
+        return EXIT_FAILURE;
+    } else if (strcmp(flag, "-p") == 0) {
+      opts.proxy = atoi(value);
+      if (opts.proxy < 1 || (opts.proxy & (opts.proxy - 1)) != 0) {
+        nob_log(NOB_ERROR, "proxy factor must be a power of two: %s", value);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(flag, "-b") == 0) {
+      opts.band = atoi(value);
+    } else if (strcmp(flag, "-s") == 0) {
+      seams_path = value;
+      opts.seams = &seams;
+    } else if (strcmp(flag, "-r") == 0) {
+      replay_path = value;
+    } else if (strcmp(flag, "-m") == 0) {
+      mask_path = value;
+    } else if (strcmp(flag, "-E") == 0) {
+      map_path = value;
+      opts.energy = ENERGY_EXTERNAL;
+    } else if (strcmp(flag, "-e") == 0) {
+      if (!energy_by_name(value, &opts.energy)) {
+        nob_log(NOB_ERROR, "unknown energy: %s", value);
+        return EXIT_FAILURE;
+      }
+    } else {
+      usage(program);
+      nob_log(NOB_ERROR, "unknown flag: %s", flag);
+      return EXIT_FAILURE;
+    }
+  }
+
   if (argc <= 0) {
     usage(program);
     nob_log(NOB_ERROR, "no input file provided");
@@ -181,43 +562,87 @@ int main(int argc, char **argv) {
   }
   const char *out_file_path = nob_shift_args(&argc, &argv);
 
-  Img img = {0};
-
-  img.items = (Pixel *)stbi_load(filepath, &img.width, &img.height, NULL,
-                                 STBI_rgb_alpha);
-  img.stride = img.width;
-  if (img.items == NULL) {
-    nob_log(NOB_ERROR, "unable to read file: %s", filepath);
+  if (opts.energy == ENERGY_EXTERNAL && map_path == NULL) {
+    nob_log(NOB_ERROR, "the external energy needs a map, pass one with -E");
     return EXIT_FAILURE;
   }
+  if (nob_get_file_type(filepath) == NOB_FILE_DIRECTORY) {
+    if (opts.target_height > 0 || seams_path != NULL || replay_path != NULL ||
+        mask_path != NULL || map_path != NULL || opts.object_removal ||
+        opts.restore_width || opts.proxy > 1) {
+      nob_log(NOB_ERROR, "frame sequences only carve columns along the seams "
+                         "of the previous frame, -H, -s, -r, -m, -E, -O, -R "
+                         "and -p take single images");
+      return EXIT_FAILURE;
+    }
+    bool ok = carve_sequence(filepath, out_file_path, opts, volume);
+    finish_stats(report, &stats);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
-  mat_alloc(Mat, lum, img.height, img.width);
-  mat_alloc(Mat, edges, img.height, img.width);
-  mat_alloc(Mat, dp, img.height, img.width);
-
-  rgb_to_lum(img, lum);
-  sobel_filter(lum, edges);
-
-  int rm_seams = 1;
-
-  rm_seams = 500; // for user to set
-
-  if (rm_seams * 3 > 2 * img.width)
-    rm_seams = (img.width * 2) / 3;
+  Raster img = {0};
 
-  while (rm_seams--) {
-    build_dp(edges, dp);
-    remove_seam(dp, img, lum, edges);
+  uint64_t begin = phase_begin(opts.stats, PHASE_DECODE);
+  if (!load_raster(filepath, &img)) {
+    nob_log(NOB_ERROR, "unable to read file: %s", filepath);
+    return EXIT_FAILURE;
+  }
+  phase_end(opts.stats, PHASE_DECODE, begin,
+            (uint64_t)img.width * img.height);
 
-    img.width--;
-    lum.width--;
-    edges.width--;
-    dp.width--;
+  if (mask_path != NULL && !load_mask(mask_path, img, &opts.mask))
+    return EXIT_FAILURE;
+  if (map_path != NULL && !load_energy_map(map_path, img, &opts.energy_map))
+    return EXIT_FAILURE;
+  if (opts.object_removal && opts.mask.items == NULL) {
+    nob_log(NOB_ERROR, "-O removes the red part of a mask, pass one with -m");
+    return EXIT_FAILURE;
+  }
+  if (opts.object_removal &&
+      (opts.target_width > 0 || opts.target_height > 0 ||
+       opts.order != ORDER_WIDTH_FIRST || opts.band > 0 || opts.proxy > 1)) {
+    nob_log(NOB_ERROR, "-O carves until the red part is gone with full seams, "
+                       "it cannot be combined with -w, -H, -o, -b or -p");
+    return EXIT_FAILURE;
   }
-  if (!stbi_write_png(out_file_path, img.width, img.height, STBI_rgb_alpha,
-                      img.items, img.stride * sizeof(*img.items))) {
+  if (opts.restore_width &&
+      (!opts.object_removal || seams_path != NULL || map_path != NULL)) {
+    nob_log(NOB_ERROR, "-R only restores the width after -O, inserted seams "
+                       "cannot be recorded with -s and the -E map cannot be "
+                       "widened along with the image");
+    return EXIT_FAILURE;
+  }
+  if (seams_path != NULL && opts.target_height > 0) {
+    nob_log(NOB_ERROR, "seam streams only record vertical seams, -s cannot "
+                       "be combined with -H");
+    return EXIT_FAILURE;
+  }
+  if (replay_path != NULL) {
+    if (!seam_stream_load(&seams, replay_path))
+      return EXIT_FAILURE;
+    if (seams.width != img.width || seams.height != img.height) {
+      nob_log(NOB_ERROR, "%s was recorded on a %dx%d image, %s is %dx%d",
+              replay_path, seams.width, seams.height, filepath, img.width,
+              img.height);
+      return EXIT_FAILURE;
+    }
+    img.width = seam_stream_replay(&seams, img.items, img.stride,
+                                   raster_pixel_size(img));
+  } else {
+    Carve_Arena arena = {0};
+    img = carve_raster(img, opts, &arena);
+    if (seams_path != NULL && !seam_stream_save(&seams, seams_path))
+      return EXIT_FAILURE;
+  }
+
+  begin = phase_begin(opts.stats, PHASE_ENCODE);
+  if (!write_raster(out_file_path, img)) {
     nob_log(NOB_ERROR, "cannot write to file: %s", out_file_path);
     return EXIT_FAILURE;
   }
+  phase_end(opts.stats, PHASE_ENCODE, begin,
+            (uint64_t)img.width * img.height);
+
+  finish_stats(report, &stats);
   return EXIT_SUCCESS;
 }
@@ -11,15 +11,58 @@ double get_time(void) {
   return tp.tv_sec + tp.tv_nsec * 0.000000001;
 }
 
+typedef enum {
+  MODE_DEFAULT,
+  MODE_RELEASE_LTO,
+  // both stages of the pgo mode, see build_pgo
+  MODE_PGO_GENERATE,
+  MODE_PGO_USE,
+} Build_Mode;
+
+static Build_Mode mode = MODE_DEFAULT;
+static const char *build_dir = "./build";
+
+static const char *build_path(const char *name) {
+  return nob_temp_sprintf("%s/%s", build_dir, name);
+}
+
 void cc(NOB_Cmd *cmd) {
   nob_cmd_append(cmd, "cc");
   nob_cmd_append(cmd, "-Wall", "-Wextra", "-ggdb");
   nob_cmd_append(cmd, "-O3");
+  switch (mode) {
+  case MODE_DEFAULT:
+    break;
+  case MODE_RELEASE_LTO:
+    nob_cmd_append(cmd, "-flto=auto");
+    break;
+  case MODE_PGO_GENERATE:
+    nob_cmd_append(cmd, "-flto=auto");
+    nob_cmd_append(cmd, nob_temp_sprintf("-fprofile-generate=%s",
+                                         build_path("profile")));
+    nob_cmd_append(cmd, "-fprofile-update=atomic");
+    break;
+  case MODE_PGO_USE:
+    nob_cmd_append(cmd, "-flto=auto");
+    nob_cmd_append(cmd,
+                   nob_temp_sprintf("-fprofile-use=%s", build_path("profile")));
+    // code the training run never reached stays optimized as usual
+    nob_cmd_append(cmd, "-fprofile-partial-training", "-Wno-missing-profile");
+    break;
+  }
+}
+
+// Objects of the pgo stages depend on the profile, not only on their source.
+static bool needs_rebuild(const char *output, const char **inputs,
+                          size_t count) {
+  if (mode == MODE_PGO_GENERATE || mode == MODE_PGO_USE)
+    return true;
+  return nob_needs_rebuild(output, inputs, count) != 0;
 }
 
 bool rebuild_stb_if_needed(NOB_Cmd *cmd, const char *implementation,
                            const char *input, const char *output) {
-  if (nob_needs_rebuild1(output, input)) {
+  if (needs_rebuild(output, &input, 1)) {
     cmd->count = 0;
     cc(cmd);
     nob_cmd_append(cmd, implementation);
@@ -34,40 +77,187 @@ bool rebuild_stb_if_needed(NOB_Cmd *cmd, const char *implementation,
   }
 }
 
+typedef struct {
+  const char *isa;
+  const char *flags[2];
+  const char *output;
+} Kernel_Variant;
+
+// kernels.c is built once per instruction set and carve.h picks one of
+// them at runtime, see kernels_select.
+static Kernel_Variant kernel_variants[] = {
+    {"sse2", {"-march=x86-64"}, "kernels_sse2.o"},
+    {"avx2", {"-march=x86-64-v3"}, "kernels_avx2.o"},
+    {"avx512", {"-march=x86-64-v4", "-mprefer-vector-width=512"},
+     "kernels_avx512.o"},
+};
+
+bool rebuild_kernels_if_needed(NOB_Cmd *cmd) {
+#ifdef __x86_64__
+  const char *inputs[] = {"kernels.c", "carve.h"};
+  for (size_t i = 0; i < NOB_ARRAY_LEN(kernel_variants); i++) {
+    Kernel_Variant v = kernel_variants[i];
+    const char *output = build_path(v.output);
+    if (!needs_rebuild(output, inputs, NOB_ARRAY_LEN(inputs))) {
+      nob_log(NOB_INFO, "%s is up to date", output);
+      continue;
+    }
+    cmd->count = 0;
+    cc(cmd);
+    for (size_t j = 0; j < NOB_ARRAY_LEN(v.flags) && v.flags[j]; j++)
+      nob_cmd_append(cmd, v.flags[j]);
+    // bit identical results to the scalar reference need unfused mul/add
+    nob_cmd_append(cmd, "-ffp-contract=off", "-fno-math-errno");
+    nob_cmd_append(cmd, nob_temp_sprintf("-DKERNELS_ISA=%s", v.isa));
+    nob_cmd_append(cmd, "-c", "-o", output, "kernels.c");
+    if (!nob_cmd_run_sync(*cmd))
+      return false;
+  }
+#else
+  (void)cmd;
+#endif
+  return true;
+}
+
+// The kernels use parts of the carve implementation, only programs that
+// carve link them.
+bool build_program(NOB_Cmd *cmd, const char *input, const char *output,
+                   bool kernels) {
+  cmd->count = 0;
+  cc(cmd);
+  nob_cmd_append(cmd, "-o", output);
+  nob_cmd_append(cmd, input);
+  nob_cmd_append(cmd, build_path("stb_image.o"));
+  nob_cmd_append(cmd, build_path("stb_image_write.o"));
+#ifdef __x86_64__
+  for (size_t i = 0; kernels && i < NOB_ARRAY_LEN(kernel_variants); i++)
+    nob_cmd_append(cmd, build_path(kernel_variants[i].output));
+#else
+  (void)kernels;
+#endif
+  nob_cmd_append(cmd, "-lm", "-pthread");
+  return nob_cmd_run_sync(*cmd);
+}
+
+bool build_all(NOB_Cmd *cmd) {
+  if (!nob_mkdir_if_not_exists(build_dir))
+    return false;
+  if (!rebuild_stb_if_needed(cmd, "-DSTB_IMAGE_IMPLEMENTATION", "stb_image.h",
+                             build_path("stb_image.o")))
+    return false;
+  if (!rebuild_stb_if_needed(cmd, "-DSTB_IMAGE_WRITE_IMPLEMENTATION",
+                             "stb_image_write.h",
+                             build_path("stb_image_write.o")))
+    return false;
+  if (!rebuild_kernels_if_needed(cmd))
+    return false;
+  if (!build_program(cmd, "main.c", build_path("main"), true))
+    return false;
+  if (!build_program(cmd, "seamd.c", build_path("seamd"), true))
+    return false;
+  if (!build_program(cmd, "seamc.c", build_path("seamc"), false))
+    return false;
+  return true;
+}
+
+// Builds everything instrumented, carves the sample images with it to
+// collect a profile, then builds everything again using that profile.
+bool build_pgo(NOB_Cmd *cmd) {
+  mode = MODE_PGO_GENERATE;
+  if (!build_all(cmd))
+    return false;
+
+  // counts from an older training run would be merged into the new ones
+  const char *profile = build_path("profile");
+  NOB_File_Paths stale = {0};
+  if (nob_file_exists(profile) && nob_read_entire_dir(profile, &stale)) {
+    for (size_t i = 0; i < stale.count; i++) {
+      if (strstr(stale.items[i], ".gcda") != NULL)
+        remove(nob_temp_sprintf("%s/%s", profile, stale.items[i]));
+    }
+  }
+
+  // every sample image, carved by a few different amounts
+  NOB_File_Paths images = {0};
+  if (!nob_read_entire_dir("./images", &images))
+    return false;
+  static const char *widths[] = {"-w", "1000", "-w", "0"};
+  for (size_t i = 0; i < images.count; i++) {
+    const char *name = images.items[i];
+    if (strncmp(name, "test_", 5) != 0)
+      continue;
+    for (size_t j = 0; j < NOB_ARRAY_LEN(widths); j += 2) {
+      cmd->count = 0;
+      nob_cmd_append(cmd, build_path("main"), widths[j], widths[j + 1]);
+      nob_cmd_append(cmd, nob_temp_sprintf("./images/%s", name));
+      nob_cmd_append(cmd, build_path("training.png"));
+      if (!nob_cmd_run_sync(*cmd))
+        return false;
+    }
+  }
+
+  mode = MODE_PGO_USE;
+  return build_all(cmd);
+}
+
+// Builds one of the helper programs and runs it with the remaining arguments.
+bool run_tool(NOB_Cmd *cmd, const char *input, const char *output, int argc,
+              char **argv) {
+  if (!build_program(cmd, input, output, true))
+    return false;
+  cmd->count = 0;
+  nob_cmd_append(cmd, output);
+  nob_da_append_many(cmd, argv, argc);
+  return nob_cmd_run_sync(*cmd);
+}
+
 int main(int argc, char *argv[]) {
   GO_REBUILD_YOURSELF(argc, argv);
 
   const char *program = nob_shift_args(&argc, &argv);
-  (void)program;
 
   NOB_Cmd cmd = {0};
 
+  bool pgo = false;
+  if (argc > 1 && strcmp(argv[0], "-m") == 0) {
+    nob_shift_args(&argc, &argv);
+    const char *name = nob_shift_args(&argc, &argv);
+    if (strcmp(name, "release-lto") == 0) {
+      mode = MODE_RELEASE_LTO;
+      build_dir = "./build/release-lto";
+    } else if (strcmp(name, "pgo") == 0) {
+      pgo = true;
+      build_dir = "./build/pgo";
+    } else if (strcmp(name, "default") != 0) {
+      nob_log(NOB_ERROR, "Usage: %s [-m default|release-lto|pgo] "
+                         "[bench|test|<carver args>]",
+              program);
+      nob_log(NOB_ERROR, "unknown build mode: %s", name);
+      return EXIT_FAILURE;
+    }
+  }
   if (!nob_mkdir_if_not_exists("./build/"))
     return EXIT_FAILURE;
-  if (!rebuild_stb_if_needed(&cmd, "-DSTB_IMAGE_IMPLEMENTATION", "stb_image.h",
-                             "./build/stb_image.o"))
+  if (!(pgo ? build_pgo(&cmd) : build_all(&cmd)))
     return EXIT_FAILURE;
-  if (!rebuild_stb_if_needed(&cmd, "-DSTB_IMAGE_WRITE_IMPLEMENTATION",
-                             "stb_image_write.h", "./build/stb_image_write.o"))
-    return EXIT_FAILURE;
-
-  const char *main_input = "main.c";
-  const char *main_output = "./build/main";
-
-  cmd.count = 0;
-  cc(&cmd);
-
-  nob_cmd_append(&cmd, "-o", main_output);
-  nob_cmd_append(&cmd, main_input);
-  nob_cmd_append(&cmd, "./build/stb_image.o");
-  nob_cmd_append(&cmd, "./build/stb_image_write.o");
-  nob_cmd_append(&cmd, "-lm");
 
-  if (!nob_cmd_run_sync(cmd))
-    return EXIT_FAILURE;
+  if (argc > 0 && strcmp(argv[0], "bench") == 0) {
+    nob_shift_args(&argc, &argv);
+    return run_tool(&cmd, "bench.c", build_path("bench"), argc, argv)
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
+  }
+  if (argc > 0 && strcmp(argv[0], "test") == 0) {
+    nob_shift_args(&argc, &argv);
+    return run_tool(&cmd, "test.c", build_path("test"), argc, argv)
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
+  }
+  if (argc == 0)
+    return EXIT_SUCCESS;
 
   cmd.count = 0;
-  nob_cmd_append(&cmd, main_output);
+  nob_cmd_append(&cmd, build_path("main"));
   nob_da_append_many(&cmd, argv, argc);
   double begin = get_time();
   if (!nob_cmd_run_sync(cmd))
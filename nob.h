@@ -629,7 +629,7 @@ defer:
 }
 
 bool nob_write_entire_file(const char *path, const void *data, size_t size) {
-  bool result = 0;
+  bool result = true;
   FILE *out_file = fopen(path, "wb");
   if (out_file == NULL) {
     nob_log(NOB_ERROR, "could not open file %s for writing: %s", path,
@@ -0,0 +1,86 @@
+/**
+ * @file protocol.h
+ * @brief Wire format spoken between seamd and seamc over a unix socket.
+ *
+ * A client sends a Seamd_Request followed by `input_size` bytes (a path or
+ * the encoded image) and `output_size` bytes (the output path, may be 0).
+ * The daemon answers with a Seamd_Response followed by `payload_size` bytes:
+ * an error message when `status` is non zero, the PNG when no output path
+ * was given, nothing otherwise. A connection may carry any number of
+ * requests.
+ */
+
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define SEAMD_MAGIC 0x4d414553u /* "SEAM" */
+#define SEAMD_VERSION 1
+#define SEAMD_DEFAULT_SOCKET "/tmp/seamd.sock"
+#define SEAMD_MAX_INPUT (1u << 30)
+#define SEAMD_MAX_PATH 4096
+
+typedef enum {
+  // input bytes are the encoded image instead of a path to it
+  SEAMD_FLAG_INLINE_INPUT = 1 << 0,
+} Seamd_Flags;
+
+typedef enum {
+  SEAMD_OK = 0,
+  SEAMD_BAD_REQUEST,
+  SEAMD_DECODE_FAILED,
+  SEAMD_ENCODE_FAILED,
+} Seamd_Status;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  int32_t target_width;
+  uint32_t energy;
+  uint32_t input_size;
+  uint32_t output_size;
+} Seamd_Request;
+
+typedef struct {
+  uint32_t magic;
+  int32_t status;
+  int32_t width;
+  int32_t height;
+  uint32_t payload_size;
+} Seamd_Response;
+
+static inline bool seamd_read_all(int fd, void *buf, size_t size) {
+  char *p = buf;
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static inline bool seamd_write_all(int fd, const void *buf, size_t size) {
+  const char *p = buf;
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+#endif // PROTOCOL_H_
@@ -0,0 +1,137 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define NOB_IMPL
+#include "nob.h"
+#include "protocol.h"
+
+static void usage(const char *program) {
+  nob_log(NOB_ERROR,
+          "Usage: %s [-s <socket>] [-w <width>] [-e <energy index>] [-i] "
+          "<input> <output>\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  const char *program = nob_shift_args(&argc, &argv);
+
+  const char *socket_path = SEAMD_DEFAULT_SOCKET;
+  Seamd_Request req = {
+      .magic = SEAMD_MAGIC,
+      .version = SEAMD_VERSION,
+  };
+  while (argc > 0 && argv[0][0] == '-') {
+    const char *flag = nob_shift_args(&argc, &argv);
+    if (strcmp(flag, "-i") == 0) {
+      req.flags |= SEAMD_FLAG_INLINE_INPUT;
+      continue;
+    }
+    if (argc <= 0) {
+      usage(program);
+      nob_log(NOB_ERROR, "no value provided for %s", flag);
+      return EXIT_FAILURE;
+    }
+    const char *value = nob_shift_args(&argc, &argv);
+    if (strcmp(flag, "-s") == 0) {
+      socket_path = value;
+    } else if (strcmp(flag, "-w") == 0) {
+      req.target_width = atoi(value);
+    } else if (strcmp(flag, "-e") == 0) {
+      req.energy = atoi(value);
+    } else {
+      usage(program);
+      nob_log(NOB_ERROR, "unknown flag: %s", flag);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc < 2) {
+    usage(program);
+    nob_log(NOB_ERROR, "no input or output file provided");
+    return EXIT_FAILURE;
+  }
+  const char *input = nob_shift_args(&argc, &argv);
+  const char *output = nob_shift_args(&argc, &argv);
+
+  // the daemon has its own working directory, so paths go over absolute
+  NOB_String_Builder in = {0};
+  char output_abs[PATH_MAX] = {0};
+  if (req.flags & SEAMD_FLAG_INLINE_INPUT) {
+    if (!nob_read_entire_file(input, &in))
+      return EXIT_FAILURE;
+  } else {
+    char input_abs[PATH_MAX];
+    if (realpath(input, input_abs) == NULL) {
+      nob_log(NOB_ERROR, "unable to resolve %s: %s", input, str_err_no);
+      return EXIT_FAILURE;
+    }
+    nob_sb_append_cstr(&in, input_abs);
+
+    // the output may not exist yet, so only its directory is resolved
+    const char *slash = strrchr(output, '/');
+    const char *dir = slash ? nob_temp_sprintf("%.*s", (int)(slash - output),
+                                               output)
+                            : ".";
+    if (slash == output)
+      dir = "/";
+    if (realpath(dir, output_abs) == NULL) {
+      nob_log(NOB_ERROR, "unable to resolve %s: %s", dir, str_err_no);
+      return EXIT_FAILURE;
+    }
+    size_t len = strlen(output_abs);
+    snprintf(output_abs + len, sizeof(output_abs) - len, "/%s",
+             slash ? slash + 1 : output);
+  }
+  req.input_size = in.count;
+  req.output_size = strlen(output_abs);
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    nob_log(NOB_ERROR, "socket path too long: %s", socket_path);
+    return EXIT_FAILURE;
+  }
+  strcpy(addr.sun_path, socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    nob_log(NOB_ERROR, "could not connect to %s: %s", socket_path,
+            str_err_no);
+    return EXIT_FAILURE;
+  }
+
+  if (!seamd_write_all(fd, &req, sizeof(req)) ||
+      !seamd_write_all(fd, in.items, in.count) ||
+      !seamd_write_all(fd, output_abs, req.output_size)) {
+    nob_log(NOB_ERROR, "could not send request: %s", str_err_no);
+    return EXIT_FAILURE;
+  }
+
+  Seamd_Response resp = {0};
+  if (!seamd_read_all(fd, &resp, sizeof(resp)) || resp.magic != SEAMD_MAGIC) {
+    nob_log(NOB_ERROR, "no response from %s", socket_path);
+    return EXIT_FAILURE;
+  }
+  char *payload = NOB_REALLOC(NULL, resp.payload_size + 1);
+  NOB_ASSERT(payload != NULL && "buy more ram lol");
+  if (!seamd_read_all(fd, payload, resp.payload_size)) {
+    nob_log(NOB_ERROR, "truncated response from %s", socket_path);
+    return EXIT_FAILURE;
+  }
+  close(fd);
+
+  if (resp.status != SEAMD_OK) {
+    nob_log(NOB_ERROR, "seamd: %.*s", (int)resp.payload_size, payload);
+    return EXIT_FAILURE;
+  }
+  if (req.output_size == 0 &&
+      !nob_write_entire_file(output, payload, resp.payload_size))
+    return EXIT_FAILURE;
+  nob_log(NOB_INFO, "carved to %dx%d", resp.width, resp.height);
+  return EXIT_SUCCESS;
+}
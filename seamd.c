@@ -0,0 +1,292 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define NOB_IMPL
+#include "nob.h"
+#define CARVE_IMPLEMENTATION
+#include "carve.h"
+#include "protocol.h"
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+#define QUEUE_CAP 64
+
+typedef struct {
+  int fds[QUEUE_CAP];
+  size_t head;
+  size_t count;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+} Conn_Queue;
+
+typedef struct {
+  Conn_Queue *queue;
+  Carve_Arena arena;
+  Carve_Stats stats;
+  NOB_String_Builder in;
+  NOB_String_Builder out;
+} Worker;
+
+static const char *socket_path = SEAMD_DEFAULT_SOCKET;
+static volatile sig_atomic_t stopping = 0;
+
+static void conn_queue_push(Conn_Queue *q, int fd) {
+  pthread_mutex_lock(&q->lock);
+  while (q->count == QUEUE_CAP)
+    pthread_cond_wait(&q->not_full, &q->lock);
+  q->fds[(q->head + q->count++) % QUEUE_CAP] = fd;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+
+static int conn_queue_pop(Conn_Queue *q) {
+  pthread_mutex_lock(&q->lock);
+  while (q->count == 0)
+    pthread_cond_wait(&q->not_empty, &q->lock);
+  int fd = q->fds[q->head];
+  q->head = (q->head + 1) % QUEUE_CAP;
+  q->count--;
+  pthread_cond_signal(&q->not_full);
+  pthread_mutex_unlock(&q->lock);
+  return fd;
+}
+
+static void sb_write_func(void *context, void *data, int size) {
+  NOB_String_Builder *sb = context;
+  nob_sb_append_buf(sb, (const char *)data, size);
+}
+
+static bool respond(int fd, Seamd_Status status, Raster img,
+                    const void *payload, size_t payload_size) {
+  Seamd_Response resp = {
+      .magic = SEAMD_MAGIC,
+      .status = status,
+      .width = img.width,
+      .height = img.height,
+      .payload_size = payload_size,
+  };
+  return seamd_write_all(fd, &resp, sizeof(resp)) &&
+         seamd_write_all(fd, payload, payload_size);
+}
+
+static bool respond_error(int fd, Seamd_Status status, const char *message) {
+  Raster none = {0};
+  nob_log(NOB_ERROR, "%s", message);
+  return respond(fd, status, none, message, strlen(message));
+}
+
+// Returns false when the connection should be dropped.
+static bool serve_request(Worker *w, int fd) {
+  Seamd_Request req = {0};
+  if (!seamd_read_all(fd, &req, sizeof(req)))
+    return false;
+  if (req.magic != SEAMD_MAGIC || req.version != SEAMD_VERSION) {
+    respond_error(fd, SEAMD_BAD_REQUEST, "bad magic or protocol version");
+    return false;
+  }
+  if (req.input_size == 0 || req.input_size > SEAMD_MAX_INPUT ||
+      req.output_size >= SEAMD_MAX_PATH ||
+      (!(req.flags & SEAMD_FLAG_INLINE_INPUT) &&
+       req.input_size >= SEAMD_MAX_PATH)) {
+    respond_error(fd, SEAMD_BAD_REQUEST, "request too large");
+    return false;
+  }
+
+  size_t total = (size_t)req.input_size + req.output_size;
+  if (w->in.capacity < total + 2) {
+    w->in.capacity = total + 2;
+    w->in.items = NOB_REALLOC(w->in.items, w->in.capacity);
+    NOB_ASSERT(w->in.items != NULL && "buy more ram lol");
+  }
+  if (!seamd_read_all(fd, w->in.items, total))
+    return false;
+  char *input = w->in.items;
+  char *output_path = NULL;
+  if (req.output_size > 0) {
+    // shift the output path by one so both strings can be terminated
+    output_path = w->in.items + req.input_size + 1;
+    memmove(output_path, w->in.items + req.input_size, req.output_size);
+    output_path[req.output_size] = '\0';
+  }
+
+  if (req.energy >= COUNT_ENERGIES)
+    return respond_error(fd, SEAMD_BAD_REQUEST, "unknown energy");
+  // requests have no room for a map
+  if (req.energy == ENERGY_EXTERNAL)
+    return respond_error(fd, SEAMD_BAD_REQUEST, "no external energy map");
+
+  Carve_Stats *stats = w->stats.trace != NULL ? &w->stats : NULL;
+  uint64_t begin = phase_begin(stats, PHASE_DECODE);
+  // the output is an 8 bit png, so the input is decoded to 8 bit as well,
+  // with the channels it has
+  Raster img = {.depth = DEPTH_8};
+  if (req.flags & SEAMD_FLAG_INLINE_INPUT) {
+    img.items = stbi_load_from_memory((const stbi_uc *)input, req.input_size,
+                                      &img.width, &img.height, &img.channels,
+                                      0);
+  } else {
+    input[req.input_size] = '\0';
+    img.items = stbi_load(input, &img.width, &img.height, &img.channels, 0);
+  }
+  if (img.items == NULL)
+    return respond_error(fd, SEAMD_DECODE_FAILED, "unable to decode input");
+  img.stride = img.width;
+  phase_end(stats, PHASE_DECODE, begin,
+            (uint64_t)img.width * img.height);
+
+  Carve_Opts opts = {
+      .target_width = req.target_width,
+      .energy = req.energy,
+      .stats = stats,
+  };
+  img = carve_raster(img, opts, &w->arena);
+
+  begin = phase_begin(stats, PHASE_ENCODE);
+  bool ok;
+  if (output_path != NULL) {
+    if (stbi_write_png(output_path, img.width, img.height, img.channels,
+                       img.items, img.stride * raster_pixel_size(img))) {
+      ok = respond(fd, SEAMD_OK, img, NULL, 0);
+    } else {
+      char message[SEAMD_MAX_PATH + 32];
+      snprintf(message, sizeof(message), "cannot write to file: %s",
+               output_path);
+      ok = respond_error(fd, SEAMD_ENCODE_FAILED, message);
+    }
+  } else {
+    w->out.count = 0;
+    if (stbi_write_png_to_func(sb_write_func, &w->out, img.width, img.height,
+                               img.channels, img.items,
+                               img.stride * raster_pixel_size(img))) {
+      ok = respond(fd, SEAMD_OK, img, w->out.items, w->out.count);
+    } else {
+      ok = respond_error(fd, SEAMD_ENCODE_FAILED, "unable to encode output");
+    }
+  }
+  phase_end(stats, PHASE_ENCODE, begin,
+            (uint64_t)img.width * img.height);
+  stbi_image_free(img.items);
+
+  if (stats != NULL) {
+    carve_stats_flush(stats);
+    for (int phase = 0; phase < COUNT_PHASES; phase++)
+      stats->samples[phase].count = 0;
+    memset(stats->pixels, 0, sizeof(stats->pixels));
+  }
+  return ok;
+}
+
+static void *worker_main(void *arg) {
+  Worker *w = arg;
+  for (;;) {
+    int fd = conn_queue_pop(w->queue);
+    while (serve_request(w, fd))
+      ;
+    close(fd);
+  }
+  return NULL;
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+static void usage(const char *program) {
+  nob_log(NOB_ERROR,
+          "Usage: %s [-j <workers>] [-T <trace.json>] [<socket>]\n", program);
+}
+
+int main(int argc, char **argv) {
+  const char *program = nob_shift_args(&argc, &argv);
+
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+  Carve_Trace trace = {0};
+  while (argc > 0 && argv[0][0] == '-') {
+    const char *flag = nob_shift_args(&argc, &argv);
+    if (strcmp(flag, "-j") == 0 && argc > 0) {
+      workers = atol(nob_shift_args(&argc, &argv));
+    } else if (strcmp(flag, "-T") == 0 && argc > 0) {
+      if (!carve_trace_open(&trace, nob_shift_args(&argc, &argv)))
+        return EXIT_FAILURE;
+    } else {
+      usage(program);
+      nob_log(NOB_ERROR, "unknown flag: %s", flag);
+      return EXIT_FAILURE;
+    }
+  }
+  if (argc > 0)
+    socket_path = nob_shift_args(&argc, &argv);
+  if (workers < 1)
+    workers = 1;
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    nob_log(NOB_ERROR, "socket path too long: %s", socket_path);
+    return EXIT_FAILURE;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    nob_log(NOB_ERROR, "could not create socket: %s", str_err_no);
+    return EXIT_FAILURE;
+  }
+  unlink(socket_path);
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listen_fd, QUEUE_CAP) < 0) {
+    nob_log(NOB_ERROR, "could not listen on %s: %s", socket_path, str_err_no);
+    return EXIT_FAILURE;
+  }
+
+  // no SA_RESTART, so accept comes back with EINTR and the loop can stop
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  Conn_Queue queue = {
+      .lock = PTHREAD_MUTEX_INITIALIZER,
+      .not_empty = PTHREAD_COND_INITIALIZER,
+      .not_full = PTHREAD_COND_INITIALIZER,
+  };
+  Worker *pool = calloc(workers, sizeof(*pool));
+  NOB_ASSERT(pool != NULL && "buy more ram lol");
+  for (long i = 0; i < workers; i++) {
+    pool[i].queue = &queue;
+    if (trace.file != NULL)
+      pool[i].stats.trace = &trace;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker_main, &pool[i]) != 0) {
+      nob_log(NOB_ERROR, "could not start worker: %s", str_err_no);
+      return EXIT_FAILURE;
+    }
+    pthread_detach(thread);
+  }
+  nob_log(NOB_INFO, "listening on %s with %ld workers", socket_path, workers);
+
+  while (!stopping) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EINTR)
+        nob_log(NOB_WARNING, "accept failed: %s", str_err_no);
+      continue;
+    }
+    conn_queue_push(&queue, fd);
+  }
+
+  nob_log(NOB_INFO, "shutting down");
+  unlink(socket_path);
+  if (trace.file != NULL)
+    carve_trace_close(&trace);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,957 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NOB_IMPL
+#include "nob.h"
+#define CARVE_IMPLEMENTATION
+#include "carve.h"
+#include "stb_image.h"
+
+// Relative error allowed between a variant's energy or dp and the reference.
+// Seam paths and pixels must always match exactly.
+#define TEST_TOLERANCE 1e-5f
+
+
+typedef struct {
+  int width;
+  int height;
+} Test_Size;
+
+static Test_Size test_sizes[] = {
+    {1, 1}, {1, 7}, {7, 1}, {2, 2}, {3, 5}, {17, 13}, {64, 48}, {131, 77},
+};
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                                       \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      nob_log(NOB_ERROR, __VA_ARGS__);                                         \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+static void test_fill(Img img, uint32_t seed) {
+  for (int y = 0; y < img.height; y++) {
+    for (int x = 0; x < img.width; x++) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      Pixel p = {
+          .red = seed & 0xff,
+          .green = (seed >> 8) & 0xff,
+          .blue = (seed >> 16) & 0xff,
+          .alpha = 255,
+      };
+      MAT_AT(img, y, x) = p;
+    }
+  }
+}
+
+static bool mat_close(Mat a, Mat b) {
+  for (int y = 0; y < a.height; y++) {
+    for (int x = 0; x < a.width; x++) {
+      float u = MAT_AT(a, y, x), v = MAT_AT(b, y, x);
+      if (fabsf(u - v) > TEST_TOLERANCE * fmaxf(1.0f, fabsf(u)))
+        return false;
+    }
+  }
+  return true;
+}
+
+// Roughly one pixel in eight protected and one in eight marked for removal.
+static void test_fill_mask(Mask mask, uint32_t seed) {
+  for (int y = 0; y < mask.height; y++) {
+    for (int x = 0; x < mask.width; x++) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      int r = seed & 7;
+      MAT_AT(mask, y, x) = r == 0 ? MASK_PROTECT : r == 1 ? MASK_REMOVE : 0;
+    }
+  }
+}
+
+static bool mask_equal(Mask a, Mask b) {
+  for (int y = 0; y < a.height; y++) {
+    if (memcmp(&MAT_AT(a, y, 0), &MAT_AT(b, y, 0), a.width) != 0)
+      return false;
+  }
+  return true;
+}
+
+static bool img_equal(Img a, Img b) {
+  if (!MAT_SAME_DIM(a, b))
+    return false;
+  for (int y = 0; y < a.height; y++) {
+    if (memcmp(&MAT_AT(a, y, 0), &MAT_AT(b, y, 0),
+               a.width * sizeof(Pixel)) != 0)
+      return false;
+  }
+  return true;
+}
+
+typedef struct {
+  Img img;
+  Mat lum;
+  Mat edges;
+  Mat dp;
+  int *seam;
+  // the row of zeros and the scratch rows the carver hands the kernels
+  float *zeros;
+  float *scratch;
+} Test_State;
+
+static Test_State test_state_alloc(Test_Size size) {
+  mat_alloc(Img, img, size.height, size.width);
+  mat_alloc(Mat, lum, size.height, size.width);
+  mat_alloc(Mat, edges, size.height, size.width);
+  mat_alloc(Mat, dp, size.height, size.width);
+  Test_State s = {img, lum, edges, dp, NULL, NULL, NULL};
+  s.seam = NOB_REALLOC(NULL, size.height * sizeof(*s.seam));
+  s.zeros = calloc(size.width, sizeof(*s.zeros));
+  s.scratch = NOB_REALLOC(NULL, 3 * size.width * sizeof(*s.scratch));
+  NOB_ASSERT(s.seam != NULL && s.zeros != NULL && s.scratch != NULL &&
+             "buy more ram lol");
+  return s;
+}
+
+static void test_state_free(Test_State *s) {
+  NOB_FREE(s->img.items);
+  NOB_FREE(s->lum.items);
+  NOB_FREE(s->edges.items);
+  NOB_FREE(s->dp.items);
+  NOB_FREE(s->seam);
+  NOB_FREE(s->zeros);
+  NOB_FREE(s->scratch);
+}
+
+// Carves a few seams with the reference and the variant side by side and
+// compares every intermediate plane after each step.
+static void test_variant(const Kernels *v, Test_Size size) {
+  const Kernels *ref = &kernels_scalar;
+  Test_State a = test_state_alloc(size);
+  Test_State b = test_state_alloc(size);
+  test_fill(a.img, 0x12345678u ^ (size.width * 31 + size.height));
+  memcpy(b.img.items, a.img.items,
+         sizeof(Pixel) * size.width * size.height);
+  mat_alloc(Mask, ma, size.height, size.width);
+  mat_alloc(Mask, mb, size.height, size.width);
+  test_fill_mask(ma, 0x2545f491u ^ (size.width * 31 + size.height));
+  memcpy(mb.items, ma.items, size.width * size.height);
+  // the last model is the default the rest of the carve runs on
+  for (int m = COUNT_LUM_MODELS - 1; m >= 0; m--) {
+    ref->rgb_to_lum(img_raster(a.img), m, a.lum);
+    v->rgb_to_lum(img_raster(b.img), m, b.lum);
+    CHECK(mat_close(a.lum, b.lum), "%s: rgb_to_lum %s differs at %dx%d",
+          v->name, lum_model_name(m), size.width, size.height);
+  }
+
+  Energy_Kernels ref_sobel = ref->energies[ENERGY_SOBEL];
+  Energy_Kernels sobel = v->energies[ENERGY_SOBEL];
+  ref_sobel.filter(img_raster(a.img), a.lum, ma, a.edges, a.zeros);
+  sobel.filter(img_raster(b.img), b.lum, mb, b.edges, b.zeros);
+  CHECK(mat_close(a.edges, b.edges), "%s: sobel filter differs at %dx%d",
+        v->name, size.width, size.height);
+
+  // caught up with update_dp after every seam instead of built again
+  mat_alloc(Mat, inc, size.height, size.width);
+  int *lo = NOB_REALLOC(NULL, 4 * size.height * sizeof(*lo));
+  NOB_ASSERT(lo != NULL && "buy more ram lol");
+  int *hi = lo + size.height, *ref_lo = hi + size.height,
+      *ref_hi = ref_lo + size.height;
+  uint8_t *dirs = NOB_REALLOC(NULL, size.height * dirs_stride(size.width));
+  NOB_ASSERT(dirs != NULL && "buy more ram lol");
+
+  int before = failures;
+  int seams = size.width / 2;
+  for (int i = 0; i < seams; i++) {
+    ref->build_dp(a.edges, a.dp);
+    v->build_dp(b.edges, b.dp);
+    CHECK(mat_close(a.dp, b.dp), "%s: build_dp differs at %dx%d seam %d",
+          v->name, size.width, size.height, i);
+    if (i == 0)
+      ref->build_dp(a.edges, inc);
+    else
+      v->update_dp(a.edges, inc, a.seam, lo, hi, b.scratch);
+    bool same = true;
+    for (int y = 0; y < size.height; y++)
+      same = same && memcmp(&MAT_AT(a.dp, y, 0), &MAT_AT(inc, y, 0),
+                            inc.width * sizeof(float)) == 0;
+    CHECK(same, "%s: update_dp differs at %dx%d seam %d", v->name,
+          size.width, size.height, i);
+
+    find_seam(a.dp, a.seam);
+    find_seam(b.dp, b.seam);
+    CHECK(memcmp(a.seam, b.seam, size.height * sizeof(int)) == 0,
+          "%s: seam path differs at %dx%d seam %d", v->name, size.width,
+          size.height, i);
+
+    int last;
+    float cost = v->build_dirs(a.edges, dirs, &last, b.scratch);
+    find_seam_dirs(dirs, a.edges.width, size.height, last, b.seam);
+    CHECK(cost == MAT_AT(a.dp, size.height - 1, a.seam[size.height - 1]) &&
+              memcmp(a.seam, b.seam, size.height * sizeof(int)) == 0,
+          "%s: build_dirs seam differs at %dx%d seam %d", v->name,
+          size.width, size.height, i);
+
+    int marked =
+        ref->remove_seam(a.seam, img_raster(a.img), a.lum, a.edges, ma);
+    // the variant compacts along the reference seam, so one mismatch above
+    // does not cascade into every check below
+    CHECK(v->remove_seam(a.seam, img_raster(b.img), b.lum, b.edges, mb) ==
+              marked,
+          "%s: remove_seam count differs at %dx%d", v->name, size.width,
+          size.height);
+    a.img.width--, a.lum.width--, a.edges.width--, a.dp.width--, ma.width--;
+    b.img.width--, b.lum.width--, b.edges.width--, b.dp.width--, mb.width--;
+    inc.width--;
+    ref_sobel.update(a.seam, img_raster(a.img), a.lum, a.edges, ma, ref_lo,
+                     ref_hi, a.zeros);
+    sobel.update(a.seam, img_raster(b.img), b.lum, b.edges, mb, lo, hi,
+                 b.zeros);
+    CHECK(memcmp(lo, ref_lo, 2 * size.height * sizeof(*lo)) == 0,
+          "%s: sobel update dirty columns differ at %dx%d", v->name,
+          size.width, size.height);
+    CHECK(img_equal(a.img, b.img), "%s: remove_seam pixels differ at %dx%d",
+          v->name, size.width, size.height);
+    CHECK(mask_equal(ma, mb), "%s: remove_seam mask differs at %dx%d",
+          v->name, size.width, size.height);
+    CHECK(mat_close(a.edges, b.edges),
+          "%s: remove_seam energy differs at %dx%d", v->name, size.width,
+          size.height);
+    if (failures > before)
+      break;
+  }
+
+  NOB_FREE(inc.items);
+  NOB_FREE(lo);
+  NOB_FREE(dirs);
+  NOB_FREE(ma.items);
+  NOB_FREE(mb.items);
+  test_state_free(&a);
+  test_state_free(&b);
+}
+
+// Every energy of a variant against the reference, first in full and then
+// refreshed along a few removed seams, on random bytes taken as rasters of a
+// few depths and channel counts. The energies of the luminance see the
+// luminance of each, the external one takes it as its map, and the color
+// ones run without one like in a carve.
+static void test_energy_variant(const Kernels *v, Test_Size size) {
+  static const struct {
+    Pixel_Depth depth;
+    int channels;
+  } layouts[] = {
+      {DEPTH_8, 1}, {DEPTH_8, 3}, {DEPTH_8, 4}, {DEPTH_16, 1}, {DEPTH_16, 2},
+  };
+  const Kernels *ref = &kernels_scalar;
+  size_t bytes = sizeof(Pixel) * size.width * size.height;
+  for (size_t l = 0; l < NOB_ARRAY_LEN(layouts); l++) {
+    for (int e = 0; e < COUNT_ENERGIES; e++) {
+      Test_State a = test_state_alloc(size);
+      Test_State b = test_state_alloc(size);
+      test_fill(a.img, 0x3c6ef372u ^ (size.width * 31 + size.height));
+      memcpy(b.img.items, a.img.items, bytes);
+      mat_alloc(Mask, ma, size.height, size.width);
+      mat_alloc(Mask, mb, size.height, size.width);
+      test_fill_mask(ma, 0x1f83d9abu ^ (size.width * 31 + size.height));
+      memcpy(mb.items, ma.items, size.width * size.height);
+      Raster ra = {size.height, size.width, size.width, layouts[l].depth,
+                   layouts[l].channels, a.img.items};
+      Raster rb = ra;
+      rb.items = b.img.items;
+      int *lo = NOB_REALLOC(NULL, 4 * size.height * sizeof(*lo));
+      NOB_ASSERT(lo != NULL && "buy more ram lol");
+      int *ref_lo = lo + 2 * size.height;
+
+      Mat la = a.lum, lb = b.lum;
+      if (energy_reads_lum(e)) {
+        ref->rgb_to_lum(ra, LUM_REC601, la);
+        memcpy(lb.items, la.items, sizeof(float) * size.width * size.height);
+      } else {
+        la.items = lb.items = NULL;
+      }
+      Energy_Kernels ref_energy = ref->energies[e], energy = v->energies[e];
+      ref_energy.filter(ra, la, ma, a.edges, a.zeros);
+      energy.filter(rb, lb, mb, b.edges, b.zeros);
+      CHECK(mat_close(a.edges, b.edges),
+            "%s: %s filter differs at %dx%d, %d channels of depth %d",
+            v->name, energy_name(e), size.width, size.height,
+            ra.channels, ra.depth);
+      for (int i = 0; i < 3 && ra.width > 1; i++) {
+        ref->build_dp(a.edges, a.dp);
+        find_seam(a.dp, a.seam);
+        ref->remove_seam(a.seam, ra, la, a.edges, ma);
+        v->remove_seam(a.seam, rb, lb, b.edges, mb);
+        ra.width--, rb.width--, ma.width--, mb.width--;
+        la.width--, a.edges.width--, a.dp.width--;
+        lb.width--, b.edges.width--;
+        ref_energy.update(a.seam, ra, la, a.edges, ma, ref_lo,
+                          ref_lo + size.height, a.zeros);
+        energy.update(a.seam, rb, lb, b.edges, mb, lo, lo + size.height,
+                      b.zeros);
+        CHECK(memcmp(lo, ref_lo, 2 * size.height * sizeof(*lo)) == 0 &&
+                  mat_close(a.edges, b.edges),
+              "%s: %s update differs at %dx%d seam %d, %d channels of "
+              "depth %d",
+              v->name, energy_name(e), size.width, size.height, i,
+              ra.channels, ra.depth);
+      }
+      // the refreshed energy is the one a full pass would find
+      ref_energy.filter(ra, la, ma, a.dp, a.zeros);
+      CHECK(mat_close(a.dp, a.edges),
+            "%s update misses a column at %dx%d, %d channels of depth %d",
+            energy_name(e), size.width, size.height, ra.channels, ra.depth);
+      NOB_FREE(lo);
+      NOB_FREE(ma.items);
+      NOB_FREE(mb.items);
+      test_state_free(&a);
+      test_state_free(&b);
+    }
+  }
+}
+
+// A column marked for removal goes with the first seam, whatever it costs,
+// and a protected one survives carving as far as carve goes.
+static void test_mask(Test_Size size) {
+  if (size.width < 2)
+    return;
+  mat_alloc(Img, img, size.height, size.width);
+  mat_alloc(Mask, mask, size.height, size.width);
+  test_fill(img, 0x6a09e667u ^ (size.width * 31 + size.height));
+  int col = size.width / 2;
+  for (int y = 0; y < size.height; y++) {
+    for (int x = 0; x < size.width; x++)
+      MAT_AT(mask, y, x) = x == col ? MASK_REMOVE : MASK_NONE;
+    MAT_AT(img, y, col).alpha = 0;
+  }
+  Carve_Arena arena = {0};
+  Carve_Opts opts = {.target_width = size.width - 1, .mask = mask};
+  Img got = carve(img, opts, &arena);
+  bool removed = true;
+  for (int y = 0; y < got.height; y++) {
+    for (int x = 0; x < got.width; x++)
+      removed = removed && MAT_AT(got, y, x).alpha != 0;
+  }
+  CHECK(removed, "masked column survived at %dx%d", size.width, size.height);
+
+  test_fill(img, 0x6a09e667u ^ (size.width * 31 + size.height));
+  img.width = mask.width = size.width;
+  for (int y = 0; y < size.height; y++) {
+    for (int x = 0; x < size.width; x++)
+      MAT_AT(mask, y, x) = x == col ? MASK_PROTECT : MASK_NONE;
+    MAT_AT(img, y, col).alpha = 0;
+  }
+  opts.target_width = 1;
+  got = carve(img, opts, &arena);
+  bool kept = true;
+  for (int y = 0; y < got.height; y++) {
+    int count = 0;
+    for (int x = 0; x < got.width; x++)
+      count += MAT_AT(got, y, x).alpha == 0;
+    kept = kept && count == 1;
+  }
+  CHECK(kept, "protected column was carved at %dx%d", size.width,
+        size.height);
+
+  carve_arena_free(&arena);
+  NOB_FREE(img.items);
+  NOB_FREE(mask.items);
+}
+
+// The external energy carves where the map says, whatever the pixels are.
+static void test_energy_map(Test_Size size) {
+  if (size.width < 2)
+    return;
+  mat_alloc(Img, img, size.height, size.width);
+  mat_alloc(Mat, map, size.height, size.width);
+  test_fill(img, 0x510e527fu ^ (size.width * 31 + size.height));
+  int col = size.width / 3;
+  for (int y = 0; y < size.height; y++) {
+    for (int x = 0; x < size.width; x++)
+      MAT_AT(map, y, x) = x == col ? 0.0f : 1.0f;
+    MAT_AT(img, y, col).alpha = 0;
+  }
+  Carve_Arena arena = {0};
+  Carve_Opts opts = {
+      .target_width = size.width - 1,
+      .energy = ENERGY_EXTERNAL,
+      .energy_map = map,
+  };
+  Img got = carve(img, opts, &arena);
+  bool removed = true;
+  for (int y = 0; y < got.height; y++) {
+    for (int x = 0; x < got.width; x++)
+      removed = removed && MAT_AT(got, y, x).alpha != 0;
+  }
+  CHECK(removed, "zero energy column of the map survived at %dx%d",
+        size.width, size.height);
+  carve_arena_free(&arena);
+  NOB_FREE(img.items);
+  NOB_FREE(map.items);
+}
+
+// Object removal stops once the marked block is gone, which takes at least
+// its width in seams, and the restore gets back to the original width.
+static void test_object_removal(Test_Size size) {
+  if (size.width < 4)
+    return;
+  mat_alloc(Img, img, size.height, size.width);
+  mat_alloc(Mask, mask, size.height, size.width);
+  for (int restore = 0; restore < 2; restore++) {
+    test_fill(img, 0xbb67ae85u ^ (size.width * 31 + size.height));
+    memset(mask.items, MASK_NONE, size.width * size.height);
+    int x0 = size.width / 4, x1 = size.width / 2;
+    for (int y = 0; y < size.height; y++) {
+      for (int x = x0; x < x1; x++) {
+        MAT_AT(mask, y, x) = MASK_REMOVE;
+        MAT_AT(img, y, x).alpha = 0;
+      }
+    }
+    Carve_Arena arena = {0};
+    Carve_Opts opts = {
+        .mask = mask, .object_removal = true, .restore_width = restore};
+    Img got = carve(img, opts, &arena);
+    bool removed = true;
+    for (int y = 0; y < got.height; y++) {
+      for (int x = 0; x < got.width; x++)
+        removed = removed && MAT_AT(got, y, x).alpha != 0;
+    }
+    CHECK(removed, "object survived at %dx%d", size.width, size.height);
+    if (restore) {
+      CHECK(got.width == size.width, "restored %dx%d to width %d",
+            size.width, size.height, got.width);
+    } else {
+      CHECK(got.width <= size.width - (x1 - x0),
+            "object removal stopped at width %d of %dx%d", got.width,
+            size.width, size.height);
+    }
+    carve_arena_free(&arena);
+  }
+  NOB_FREE(img.items);
+  NOB_FREE(mask.items);
+}
+
+// Replaying the recorded seams on a copy of the input, after a round trip
+// through a file, must give exactly what the carve did.
+static void test_seam_stream(Test_Size size, int proxy, int band) {
+  mat_alloc(Img, img, size.height, size.width);
+  mat_alloc(Img, copy, size.height, size.width);
+  test_fill(img, 0x9e3779b9u ^ (size.width * 31 + size.height));
+  memcpy(copy.items, img.items, sizeof(Pixel) * size.width * size.height);
+
+  Seam_Stream seams = {0}, loaded = {0};
+  Carve_Arena arena = {0};
+  Carve_Opts opts = {
+      .target_width = 1, .seams = &seams, .proxy = proxy, .band = band};
+  Img got = carve(img, opts, &arena);
+  const char *path = "./build/test_seams.bin";
+  if (seam_stream_save(&seams, path) && seam_stream_load(&loaded, path)) {
+    copy.width = seam_stream_replay(&loaded, copy.items, copy.stride,
+                                    sizeof(*copy.items));
+    CHECK(img_equal(got, copy),
+          "seam stream replay differs at %dx%d with proxy %d band %d",
+          size.width, size.height, proxy, band);
+  } else {
+    CHECK(false, "seam stream round trip failed at %dx%d", size.width,
+          size.height);
+  }
+
+  seam_stream_free(&seams);
+  seam_stream_free(&loaded);
+  carve_arena_free(&arena);
+  NOB_FREE(img.items);
+  NOB_FREE(copy.items);
+}
+
+// A stream of the right size whose seam starts outside the image or takes a
+// step that is not -1, 0 or +1 must be refused by seam_stream_load.
+static void test_seam_stream_corrupt(void) {
+  Seam_Stream seams = {0}, loaded = {0};
+  seam_stream_begin(&seams, 4, 3);
+  int seam[] = {1, 2, 2};
+  seam_stream_push(&seams, seam);
+  const char *path = "./build/test_seams.bin";
+
+  uint32_t start = 4;
+  memcpy(seams.items, &start, sizeof(start));
+  CHECK(!seam_stream_save(&seams, path) || !seam_stream_load(&loaded, path),
+        "seam stream starting outside the image was loaded");
+  start = 1;
+  memcpy(seams.items, &start, sizeof(start));
+  seams.items[sizeof(start)] |= 3;
+  CHECK(!seam_stream_save(&seams, path) || !seam_stream_load(&loaded, path),
+        "seam stream with a step of 3 was loaded");
+
+  seam_stream_free(&seams);
+  seam_stream_free(&loaded);
+}
+
+// A frame identical to the previous one has its best seams right where the
+// prior ones are, so following them must reproduce the same carve.
+static void test_prior(Test_Size size) {
+  mat_alloc(Img, first, size.height, size.width);
+  mat_alloc(Img, second, size.height, size.width);
+  test_fill(first, 0x3c6ef372u ^ (size.width * 31 + size.height));
+  memcpy(second.items, first.items, sizeof(Pixel) * size.width * size.height);
+
+  Seam_Stream seams[2] = {0};
+  Carve_Arena arena = {0};
+  Carve_Opts opts = {.target_width = 1, .seams = &seams[0]};
+  Img a = carve(first, opts, &arena);
+  opts.seams = &seams[1];
+  opts.prior = &seams[0];
+  Img b = carve(second, opts, &arena);
+  CHECK(img_equal(a, b), "carve along the prior differs at %dx%d", size.width,
+        size.height);
+
+  seam_stream_free(&seams[0]);
+  seam_stream_free(&seams[1]);
+  carve_arena_free(&arena);
+  NOB_FREE(first.items);
+  NOB_FREE(second.items);
+}
+
+// Cheapest seam surface of a tiny volume with random energy and a wandering
+// band, by trying every surface there is.
+static float test_cut_best(const Cut_Volume *v, int *labels, int at) {
+  int rows = v->frames * v->height;
+  if (at == rows) {
+    float cost = 0;
+    for (int r = 0; r < rows; r++)
+      cost += v->cap[r * v->band + labels[r] - v->lo[r % v->height]];
+    return cost;
+  }
+  int y = at % v->height;
+  float best = INFINITY;
+  for (int i = 0; i < v->band; i++) {
+    int x = v->lo[y] + i;
+    // rows above and the same row of the frame before are already chosen
+    if (y > 0 && abs(labels[at - 1] - x) > 1)
+      continue;
+    if (at >= v->height && abs(labels[at - v->height] - x) > 1)
+      continue;
+    labels[at] = x;
+    float cost = test_cut_best(v, labels, at + 1);
+    best = cost < best ? cost : best;
+  }
+  return best;
+}
+
+static void test_cut(uint32_t seed) {
+  enum { FRAMES = 2, HEIGHT = 4, BAND = 4 };
+  int lo[HEIGHT], seams[FRAMES * HEIGHT], labels[FRAMES * HEIGHT];
+  Cut_Volume v = cut_volume_alloc(FRAMES, HEIGHT, BAND, lo);
+  for (int y = 0; y < HEIGHT; y++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    lo[y] = y == 0 ? 1 : lo[y - 1] + (int)(seed % 3) - 1;
+    lo[y] = lo[y] < 0 ? 0 : lo[y] > 2 ? 2 : lo[y];
+  }
+  for (int u = 0; u < FRAMES * HEIGHT * BAND; u++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    v.cap[u] = (float)(seed % 1000) / 100;
+  }
+  float want = test_cut_best(&v, labels, 0);
+  cut_volume_solve(&v, seams);
+  bool connected = true;
+  float got = 0;
+  for (int r = 0; r < FRAMES * HEIGHT; r++) {
+    int y = r % HEIGHT;
+    got += v.cap[r * BAND + seams[r] - lo[y]];
+    if (y > 0 && abs(seams[r] - seams[r - 1]) > 1)
+      connected = false;
+    if (r >= HEIGHT && abs(seams[r] - seams[r - HEIGHT]) > 1)
+      connected = false;
+  }
+  CHECK(connected, "cut surface with seed %u is torn", seed);
+  CHECK(fabsf(got - want) <= TEST_TOLERANCE * fmaxf(1.0f, want),
+        "cut surface with seed %u costs %f, the cheapest one %f", seed, got,
+        want);
+  cut_volume_free(&v);
+}
+
+// With a band covering every column and identical frames, the cheapest seam
+// surface is the cheapest seam of one frame in every frame, so the volume
+// carve has to match the plain one.
+static void test_volume(Test_Size size) {
+  enum { FRAMES = 3 };
+  mat_alloc(Img, img, size.height, size.width);
+  test_fill(img, 0xa54ff53au ^ (size.width * 31 + size.height));
+  Img frames[FRAMES];
+  for (int t = 0; t < FRAMES; t++) {
+    mat_alloc(Img, frame, size.height, size.width);
+    memcpy(frame.items, img.items, sizeof(Pixel) * size.width * size.height);
+    frames[t] = frame;
+  }
+
+  Carve_Arena arena = {0};
+  Carve_Opts opts = {.target_width = 1, .band = size.width};
+  Img want = carve(img, opts, &arena);
+  carve_volume(frames, FRAMES, opts);
+  for (int t = 0; t < FRAMES; t++) {
+    CHECK(img_equal(want, frames[t]),
+          "volume carve of frame %d differs at %dx%d", t, size.width,
+          size.height);
+    NOB_FREE(frames[t].items);
+  }
+
+  carve_arena_free(&arena);
+  NOB_FREE(img.items);
+}
+
+// A band covering every column has to give the same dp and seam as the
+// unrestricted reference.
+static void test_band(Test_Size size) {
+  Test_State s = test_state_alloc(size);
+  mat_alloc(Mat, band_dp, size.height, size.width);
+  int *lo = NOB_REALLOC(NULL, size.height * sizeof(*lo));
+  int *hi = NOB_REALLOC(NULL, size.height * sizeof(*hi));
+  int *seam = NOB_REALLOC(NULL, size.height * sizeof(*seam));
+  NOB_ASSERT(lo != NULL && hi != NULL && seam != NULL && "buy more ram lol");
+  for (int y = 0; y < size.height; y++) {
+    lo[y] = 0;
+    hi[y] = size.width - 1;
+  }
+  test_fill(s.img, 0xdeadbeefu ^ (size.width * 31 + size.height));
+  rgb_to_lum(img_raster(s.img), LUM_REC601, s.lum);
+  sobel_filter(img_raster(s.img), s.lum, (Mask){0}, s.edges, s.zeros);
+  build_dp(s.edges, s.dp);
+  build_dp_band(s.edges, band_dp, lo, hi);
+  find_seam(s.dp, s.seam);
+  find_seam_band(band_dp, lo, hi, seam);
+  CHECK(mat_close(s.dp, band_dp), "build_dp_band differs at %dx%d",
+        size.width, size.height);
+  CHECK(memcmp(s.seam, seam, size.height * sizeof(int)) == 0,
+        "find_seam_band differs at %dx%d", size.width, size.height);
+
+  NOB_FREE(band_dp.items);
+  NOB_FREE(lo);
+  NOB_FREE(hi);
+  NOB_FREE(seam);
+  test_state_free(&s);
+}
+
+// With a band wider than the image every seam is the one the full dp finds.
+static void test_wide_band(Test_Size size) {
+  mat_alloc(Img, a, size.height, size.width);
+  mat_alloc(Img, b, size.height, size.width);
+  test_fill(a, 0x2545f491u ^ (size.width * 31 + size.height));
+  memcpy(b.items, a.items, sizeof(Pixel) * size.width * size.height);
+  Carve_Arena arena = {0};
+  Carve_Opts opts = {.target_width = 1};
+  Img want = carve(a, opts, &arena);
+  opts.band = size.width;
+  Img got = carve(b, opts, &arena);
+  CHECK(img_equal(want, got), "banded carve differs at %dx%d", size.width,
+        size.height);
+  carve_arena_free(&arena);
+  NOB_FREE(a.items);
+  NOB_FREE(b.items);
+}
+
+// Checks a horizontal seam against a plain column by column dp, and its
+// removal against moving every column up by hand and a fresh sobel.
+static void test_horizontal(Test_Size size) {
+  Test_State s = test_state_alloc(size);
+  mat_alloc(Img, want, size.height, size.width);
+  int *seam = NOB_REALLOC(NULL, size.width * sizeof(*seam));
+  NOB_ASSERT(seam != NULL && "buy more ram lol");
+  test_fill(s.img, 0x7f4a7c15u ^ (size.width * 31 + size.height));
+  memcpy(want.items, s.img.items, sizeof(Pixel) * size.width * size.height);
+  rgb_to_lum(img_raster(s.img), LUM_REC601, s.lum);
+  sobel_filter(img_raster(s.img), s.lum, (Mask){0}, s.edges, s.zeros);
+
+  for (int x = 0; x < size.width; x++) {
+    for (int y = 0; y < size.height; y++) {
+      float m = 0;
+      if (x > 0) {
+        m = FLT_MAX;
+        for (int dy = -1; dy < 2; dy++) {
+          if (y + dy >= 0 && y + dy < size.height)
+            m = fminf(m, MAT_AT(s.dp, y + dy, x - 1));
+        }
+      }
+      MAT_AT(s.dp, y, x) = MAT_AT(s.edges, y, x) + m;
+    }
+  }
+  float best = FLT_MAX;
+  for (int y = 0; y < size.height; y++)
+    best = fminf(best, MAT_AT(s.dp, y, size.width - 1));
+  float cost = find_seam_horizontal(&kernels_scalar, s.edges, s.dp.items, seam);
+  CHECK(cost == best, "horizontal seam costs %f instead of %f at %dx%d", cost,
+        best, size.width, size.height);
+
+  remove_seam_horizontal(seam, img_raster(s.img), s.lum, s.edges, (Mask){0});
+  for (int x = 0; x < size.width; x++) {
+    for (int y = seam[x]; y + 1 < size.height; y++)
+      MAT_AT(want, y, x) = MAT_AT(want, y + 1, x);
+  }
+  if (size.height > 1) {
+    s.img.height--, s.lum.height--, s.edges.height--, want.height--;
+    energy_updates_horizontal[ENERGY_SOBEL](seam, img_raster(s.img), s.lum,
+                                            s.edges, (Mask){0});
+    Mat fresh = {s.lum.height, s.lum.width, s.lum.stride, s.dp.items};
+    sobel_filter(img_raster(s.img), s.lum, (Mask){0}, fresh, s.zeros);
+    CHECK(img_equal(s.img, want), "horizontal seam pixels differ at %dx%d",
+          size.width, size.height);
+    CHECK(mat_close(s.edges, fresh), "horizontal seam energy differs at %dx%d",
+          size.width, size.height);
+  }
+
+  NOB_FREE(want.items);
+  NOB_FREE(seam);
+  test_state_free(&s);
+}
+
+// Every order has to end up at the requested size.
+static void test_orders(Test_Size size) {
+  mat_alloc(Img, img, size.height, size.width);
+  Carve_Arena arena = {0};
+  for (int order = 0; order < COUNT_ORDERS; order++) {
+    test_fill(img, 0x1b873593u ^ (size.width * 31 + size.height));
+    img.width = size.width, img.height = size.height;
+    Carve_Opts opts = {
+        .target_width = size.width - size.width / 3,
+        .target_height = size.height - size.height / 3,
+        .order = order,
+    };
+    Img got = carve(img, opts, &arena);
+    CHECK(got.width == size.width - carve_seams_for(img, opts) &&
+              got.height == size.height - carve_rows_for(img, opts),
+          "%s order carved %dx%d to %dx%d", order_name(order), size.width,
+          size.height, got.width, got.height);
+  }
+  carve_arena_free(&arena);
+  NOB_FREE(img.items);
+}
+
+// Every way of keeping the dp has to find the same seams.
+static void test_dp_modes(Test_Size size) {
+  mat_alloc(Img, want, size.height, size.width);
+  mat_alloc(Img, img, size.height, size.width);
+  Carve_Arena arena = {0};
+  test_fill(want, 0x85ebca6bu ^ (size.width * 31 + size.height));
+  Carve_Opts opts = {.target_width = size.width - size.width / 2};
+  want = carve(want, opts, &arena);
+  for (int mode = 0; mode < COUNT_DP_MODES; mode++) {
+    test_fill(img, 0x85ebca6bu ^ (size.width * 31 + size.height));
+    img.width = size.width;
+    opts.dp = mode;
+    Img got = carve(img, opts, &arena);
+    CHECK(img_equal(got, want), "%s dp carves differently at %dx%d",
+          dp_mode_name(mode), size.width, size.height);
+  }
+  // a plane over budget goes to checkpoints on its own
+  test_fill(img, 0x85ebca6bu ^ (size.width * 31 + size.height));
+  img.width = size.width;
+  opts.dp = DP_PLANE;
+  opts.dp_budget = 1;
+  CHECK(img_equal(carve(img, opts, &arena), want),
+        "dp over budget carves differently at %dx%d", size.width,
+        size.height);
+  carve_arena_free(&arena);
+  NOB_FREE(want.items);
+  NOB_FREE(img.items);
+}
+
+// A few colors with a known luminance in every model.
+static void test_lum_models(void) {
+  static const struct {
+    Pixel pixel;
+    float lum[COUNT_LUM_MODELS];
+  } cases[] = {
+      {{0, 0, 0, 255}, {0, 0, 0, 0}},
+      {{255, 255, 255, 255}, {1, 1, 1, 1}},
+      {{0, 255, 0, 255}, {0.587f, 0.7152f, 0.7152f, 0.877370f}},
+      // 18% gray, the middle of the L* scale
+      {{118, 118, 118, 255}, {0.462745f, 0.462745f, 0.181164f, 0.496370f}},
+      {{10, 10, 10, 255}, {0.039216f, 0.039216f, 0.003035f, 0.027417f}},
+  };
+  mat_alloc(Img, img, 1, NOB_ARRAY_LEN(cases));
+  mat_alloc(Mat, lum, 1, NOB_ARRAY_LEN(cases));
+  for (size_t i = 0; i < NOB_ARRAY_LEN(cases); i++)
+    MAT_AT(img, 0, i) = cases[i].pixel;
+  for (int m = 0; m < COUNT_LUM_MODELS; m++) {
+    rgb_to_lum(img_raster(img), m, lum);
+    for (size_t i = 0; i < NOB_ARRAY_LEN(cases); i++) {
+      float want = cases[i].lum[m], got = MAT_AT(lum, 0, i);
+      CHECK(fabsf(got - want) < 1e-5f, "%s luminance of color %zu is %f, "
+            "not %f", lum_model_name(m), i, got, want);
+    }
+  }
+  NOB_FREE(img.items);
+  NOB_FREE(lum.items);
+}
+
+// The channel c of pixel i of an RGBA image as a raster of fewer channels
+// would have it: gray images keep red and alpha.
+static int test_channel(int channels, int c) {
+  static const int gray[2] = {0, 3};
+  return channels < 3 ? gray[c] : c;
+}
+
+// Copies of an image in every depth and channel count carve like the 8 bit
+// RGBA one, keeping their depth and channels. Gray copies are checked
+// against an RGBA image with the same red, green and blue.
+static void test_rasters(const Kernels *k, Test_Size size) {
+  mat_alloc(Img, src, size.height, size.width);
+  mat_alloc(Img, want, size.height, size.width);
+  size_t pixels = (size_t)size.width * size.height;
+  void *items = NOB_REALLOC(NULL, pixels * 4 * sizeof(float));
+  NOB_ASSERT(items != NULL && "buy more ram lol");
+  Carve_Arena arena = {0};
+  Carve_Opts opts = {.target_width = size.width - size.width / 2,
+                     .kernels = k};
+  const uint8_t *bytes = (const uint8_t *)src.items;
+  for (int channels = 1; channels <= 4; channels++) {
+    test_fill(src, 0x510e527fu ^ (size.width * 31 + size.height));
+    for (size_t i = 0; channels < 3 && i < pixels; i++)
+      src.items[i].green = src.items[i].blue = src.items[i].red;
+    memcpy(want.items, src.items, pixels * sizeof(Pixel));
+    want.width = size.width;
+    want = carve(want, opts, &arena);
+    for (int depth = 0; depth < COUNT_DEPTHS; depth++) {
+      Raster r = {size.height, size.width, size.width, depth, channels, items};
+      for (size_t i = 0; i < pixels * channels; i++) {
+        uint8_t v = bytes[4 * (i / channels) + test_channel(channels,
+                                                            i % channels)];
+        if (depth == DEPTH_8)
+          ((uint8_t *)items)[i] = v;
+        else if (depth == DEPTH_16)
+          ((uint16_t *)items)[i] = v * 257;
+        else
+          ((float *)items)[i] = v / 255.0f;
+      }
+      r = carve_raster(r, opts, &arena);
+      bool same = r.width == want.width;
+      for (int y = 0; same && y < want.height; y++) {
+        const uint8_t *row = (const uint8_t *)&MAT_AT(want, y, 0);
+        const uint8_t *got = raster_row(r, y);
+        for (int i = 0; same && i < want.width * channels; i++) {
+          uint8_t v = row[4 * (i / channels) + test_channel(channels,
+                                                            i % channels)];
+          if (depth == DEPTH_8)
+            same = got[i] == v;
+          else if (depth == DEPTH_16)
+            same = ((const uint16_t *)got)[i] == v * 257;
+          else
+            same = ((const float *)got)[i] == v / 255.0f;
+        }
+      }
+      CHECK(same, "%s: %d channels of depth %d carve differently at %dx%d",
+            k->name, channels, depth, size.width, size.height);
+    }
+  }
+  carve_arena_free(&arena);
+  NOB_FREE(src.items);
+  NOB_FREE(want.items);
+  NOB_FREE(items);
+}
+
+static void test_golden(const Kernels *k, const char *input, int seams,
+                        const char *golden) {
+  Img img = {0}, want = {0};
+  img.items = (Pixel *)stbi_load(input, &img.width, &img.height, NULL,
+                                 STBI_rgb_alpha);
+  want.items = (Pixel *)stbi_load(golden, &want.width, &want.height, NULL,
+                                  STBI_rgb_alpha);
+  if (img.items == NULL || want.items == NULL) {
+    CHECK(false, "unable to read %s or %s", input, golden);
+    return;
+  }
+  img.stride = img.width;
+  want.stride = want.width;
+
+  Carve_Arena arena = {0};
+  Carve_Opts opts = {.target_width = img.width - seams, .kernels = k};
+  Img got = carve(img, opts, &arena);
+  bool ok = img_equal(got, want);
+  CHECK(ok, "%s does not match %s", input, golden);
+  if (ok)
+    nob_log(NOB_INFO, "%s matches with %s kernels", golden, k->name);
+
+  carve_arena_free(&arena);
+  stbi_image_free(img.items);
+  stbi_image_free(want.items);
+}
+
+int main(int argc, char **argv) {
+  const char *program = nob_shift_args(&argc, &argv);
+  (void)program;
+  bool kernels_only = argc > 0 && strcmp(argv[0], "-k") == 0;
+
+  for (size_t i = 0; i < carve_kernels_count; i++) {
+    const Kernels *k = carve_kernels[i];
+    if (!k->supported()) {
+      nob_log(NOB_WARNING, "%s kernels are not supported here, skipping",
+              k->name);
+      continue;
+    }
+    int before = failures;
+    for (size_t j = 0; j < NOB_ARRAY_LEN(test_sizes); j++) {
+      test_variant(k, test_sizes[j]);
+      test_energy_variant(k, test_sizes[j]);
+      test_rasters(k, test_sizes[j]);
+    }
+    if (failures == before)
+      nob_log(NOB_INFO, "%s kernels match the reference", k->name);
+  }
+
+  if (!kernels_only) {
+    int before = failures;
+    for (uint32_t seed = 1; seed <= 64; seed++)
+      test_cut(seed * 0x9e3779b9u);
+    test_lum_models();
+    for (size_t j = 0; j < NOB_ARRAY_LEN(test_sizes); j++) {
+      test_band(test_sizes[j]);
+      test_wide_band(test_sizes[j]);
+      test_mask(test_sizes[j]);
+      test_energy_map(test_sizes[j]);
+      test_object_removal(test_sizes[j]);
+      test_prior(test_sizes[j]);
+      test_volume(test_sizes[j]);
+      test_horizontal(test_sizes[j]);
+      test_orders(test_sizes[j]);
+      test_dp_modes(test_sizes[j]);
+      test_seam_stream(test_sizes[j], 0, 0);
+      test_seam_stream(test_sizes[j], 4, 0);
+      test_seam_stream(test_sizes[j], 0, 4);
+    }
+    test_seam_stream_corrupt();
+    if (failures == before)
+      nob_log(NOB_INFO, "dp modes, banded dp, horizontal seams, masks, cuts "
+                        "and seam stream replays match");
+
+    // the goldens are checked with the reference and the fastest kernels
+    const Kernels *golden_kernels[] = {&kernels_scalar, kernels_select(NULL)};
+    static const int seams[] = {300, 400, 500};
+    for (size_t k = 0; k < NOB_ARRAY_LEN(golden_kernels); k++) {
+      if (k > 0 && golden_kernels[k] == golden_kernels[0])
+        break;
+      for (int i = 0; i < 3; i++) {
+        for (size_t j = 0; j < NOB_ARRAY_LEN(seams); j++) {
+          test_golden(golden_kernels[k],
+                      nob_temp_sprintf("./images/test_%d.jpg", i), seams[j],
+                      nob_temp_sprintf("./images/output_%d_%d.png", i,
+                                       seams[j]));
+        }
+      }
+    }
+  }
+
+  if (failures > 0) {
+    nob_log(NOB_ERROR, "%d checks failed", failures);
+    return EXIT_FAILURE;
+  }
+  nob_log(NOB_INFO, "all tests passed");
+  return EXIT_SUCCESS;
+}